@@ -0,0 +1,636 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Cycle accurate benchmark of the input to switch path. This runs the real
+    firmware image under simavr, feeds it input via the PS/2 keyboard pins,
+    the serial port, and the joystick pins, and counts CPU cycles from the
+    input edge to the rising edge of the MT88xx strobe. Input edges are:
+
+        PS/2        falling clock edge of the stop bit of the last byte of the
+                    scan code sequence
+        serial      end of the stop bit of the last byte of the frame, as if
+                    the host had sent the frame back to back
+        joystick    change of the PINC bit
+
+    For each source, a plain key, a combo, and a macro are measured, using
+    the first suitable input key for the target the benchmark was built for.
+    Macros are triggered on key release, so that's what's measured for them.
+    Repetitions are spread across the scheduler tick, to show best & worst
+    case. Use the `bench` target in the Makefile for building & running.
+ */
+
+#include <algorithm>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_uart.h>
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "input_keycodes.h"
+#include "joystick.h"
+#include "serialproto.h"
+
+// --- constants --------------------------------------------------------------
+
+static const avr_cycle_count_t US = F_CPU / 1000000UL;
+static const avr_cycle_count_t MS = 1000 * US;
+
+// PS/2 clock runs at 12.5kHz
+static const avr_cycle_count_t PS2_HALF_BIT = 40 * US;
+static const avr_cycle_count_t PS2_BYTE_GAP = 500 * US;
+static const avr_cycle_count_t PS2_BAT_DELAY = 10 * MS;
+
+// Serial frames are 10 bits long.
+static const avr_cycle_count_t SERIAL_FRAME = 10 * F_CPU / SERIAL_BAUD;
+
+// A case is done when there was no strobe for this long. This needs to be
+// longer than any delay within macros.
+static const avr_cycle_count_t SETTLE = 300 * MS;
+static const avr_cycle_count_t STROBE_TIMEOUT = 1000 * MS;
+
+// Repetitions are shifted against each other by this many cycles, so that
+// they hit different points in the scheduler tick. It's prime, so that
+// offsets don't repeat within a tick.
+static const avr_cycle_count_t PHASE_STEP = 997;
+
+// Port D pins, see spectratur.ino
+static const uint8_t PIN_PS2_CLOCK = 3;
+static const uint8_t PIN_PS2_DATA  = 4;
+static const uint8_t PIN_STROBE    = 7;
+
+// --- input keys -------------------------------------------------------------
+
+//
+struct InputKey {
+    uint8_t code;       // input key code
+    const char *name;
+    bool extended;      // scan code has E0 prefix
+    uint8_t scan;       // PS/2 scan code set 2
+};
+
+// Candidates for measuring, in order of preference. F1 and ESC have special
+// functions in the firmware, so they're not included.
+static const InputKey INPUT_KEYS[] = {
+    {KEY_A,          "A",          false, 0x1c},
+    {KEY_1,          "1",          false, 0x16},
+    {KEY_UP,         "UP",         true,  0x75},
+    {KEY_DOWN,       "DOWN",       true,  0x72},
+    {KEY_LEFT,       "LEFT",       true,  0x6b},
+    {KEY_RIGHT,      "RIGHT",      true,  0x74},
+    {KEY_MINUS,      "MINUS",      false, 0x4e},
+    {KEY_EQUAL,      "EQUAL",      false, 0x55},
+    {KEY_BACKSPACE,  "BACKSPACE",  false, 0x66},
+    {KEY_SEMICOLON,  "SEMICOLON",  false, 0x4c},
+    {KEY_APOSTROPHE, "APOSTROPHE", false, 0x52},
+    {KEY_COMMA,      "COMMA",      false, 0x41},
+    {KEY_DOT,        "DOT",        false, 0x49},
+    {KEY_SLASH,      "SLASH",      false, 0x4a},
+    {KEY_F2,         "F2",         false, 0x06},
+    {KEY_F3,         "F3",         false, 0x04},
+    {KEY_F4,         "F4",         false, 0x0c},
+    {KEY_F5,         "F5",         false, 0x03},
+    {KEY_F6,         "F6",         false, 0x0b},
+    {KEY_F7,         "F7",         false, 0x83},
+    {KEY_F8,         "F8",         false, 0x0a},
+    {KEY_F9,         "F9",         false, 0x01},
+    {KEY_F10,        "F10",        false, 0x09},
+    {KEY_F11,        "F11",        false, 0x78},
+    {KEY_F12,        "F12",        false, 0x07}
+};
+
+//
+enum KeyClass {
+    CLASS_KEY,
+    CLASS_COMBO,
+    CLASS_MACRO,
+    CLASS_NONE
+};
+
+static const char *CLASS_NAMES[] = {"key", "combo", "macro"};
+
+//
+static KeyClass classify(uint8_t k) {
+    if (k == NA) {
+        return CLASS_NONE;
+    }
+    if ((k & K_SPECIAL) == 0) {
+        return CLASS_KEY;
+    }
+    uint8_t ix = k & ~K_SPECIAL;
+    if (ix < END_OF_COMBOS) {
+        return CLASS_COMBO;
+    }
+    if (ix > END_OF_COMBOS && ix < END_OF_SPECIALS) {
+        return CLASS_MACRO;
+    }
+    return CLASS_NONE;
+}
+
+// Returns first input key in the target's key map of given class, or NULL.
+static const InputKey *findKey(KeyClass c) {
+    for (size_t ix = 0; ix < array_len(INPUT_KEYS); ix++) {
+        uint8_t code = INPUT_KEYS[ix].code;
+        if (code < array_len(MAP_INPUT_TO_TARGET)
+            && classify(MAP_INPUT_TO_TARGET[code]) == c) {
+            return &INPUT_KEYS[ix];
+        }
+    }
+    return NULL;
+}
+
+// --- simulation -------------------------------------------------------------
+
+static avr_t *avr = NULL;
+
+static avr_irq_t *ps2ClockIrq = NULL;
+static avr_irq_t *ps2DataIrq = NULL;
+static avr_irq_t *uartInIrq = NULL;
+static avr_irq_t *joystickIrq[JOYSTICK_ACTIONS];
+
+// state of port D as set by firmware, for modelling the open collector PS/2
+// lines
+static uint8_t ddrD = 0;
+static uint8_t portD = 0;
+
+// strobe tracking
+static bool strobeHigh = false;
+static avr_cycle_count_t lastStrobe = 0;
+static avr_cycle_count_t armedSince = 0;
+static avr_cycle_count_t firstStrobe = 0;
+
+//
+static void runUntil(avr_cycle_count_t c) {
+    while (avr->cycle < c) {
+        int state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "firmware stopped, state %d\n", state);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+//
+static void runFor(avr_cycle_count_t c) {
+    runUntil(avr->cycle + c);
+}
+
+// Runs until there was no strobe for SETTLE cycles.
+static void settle() {
+    do {
+        runFor(SETTLE / 10);
+    } while (avr->cycle - lastStrobe < SETTLE);
+}
+
+// Starts looking for the first strobe from now on.
+static void arm() {
+    armedSince = avr->cycle;
+    firstStrobe = 0;
+}
+
+// Runs until the first strobe since arming. Returns false on timeout.
+static bool waitForStrobe() {
+    avr_cycle_count_t end = avr->cycle + STROBE_TIMEOUT;
+    while (firstStrobe == 0 && avr->cycle < end) {
+        runFor(10 * US);
+    }
+    return firstStrobe != 0;
+}
+
+//
+static void strobeChanged(avr_irq_t *irq, uint32_t value, void *param) {
+    bool high = value != 0;
+    if (high && !strobeHigh) {
+        lastStrobe = avr->cycle;
+        if (firstStrobe == 0 && avr->cycle >= armedSince) {
+            firstStrobe = avr->cycle;
+        }
+    }
+    strobeHigh = high;
+}
+
+// --- PS/2 keyboard ----------------------------------------------------------
+
+/*
+    A minimal PS/2 keyboard. It sends queued bytes to the host, and answers
+    commands from the host, so that the firmware's keyboard reset and setup
+    go through. Both lines are open collector: a line is low when either the
+    device or the firmware pulls it low.
+ */
+
+enum Ps2State {
+    PS2_IDLE,
+    PS2_SENDING,
+    PS2_RECEIVING
+};
+
+static struct {
+    Ps2State state;
+    uint8_t queue[32];
+    avr_cycle_count_t delays[32];   // delay before sending each byte
+    uint8_t head;
+    uint8_t count;
+    uint16_t frame;                 // bits to send or received, LSB first
+    uint8_t bit;
+    uint8_t phase;
+    avr_cycle_count_t lastStop;     // falling clock edge of last stop bit
+} ps2;
+
+//
+static bool firmwarePullsLow(uint8_t pin) {
+    uint8_t mask = 1 << pin;
+    return (ddrD & mask) && !(portD & mask);
+}
+
+//
+static void ps2Clock(bool high) {
+    avr_raise_irq(ps2ClockIrq, high ? 1 : 0);
+}
+
+//
+static void ps2Data(bool high) {
+    avr_raise_irq(ps2DataIrq, high ? 1 : 0);
+}
+
+static avr_cycle_count_t ps2Tick(avr_t *avr, avr_cycle_count_t when,
+    void *param);
+
+// Starts sending the next queued byte, if any.
+static void ps2Next() {
+    if (ps2.state != PS2_IDLE || ps2.count == 0) {
+        return;
+    }
+    uint8_t b = ps2.queue[ps2.head];
+    uint8_t parity = !__builtin_parity(b);
+    ps2.frame = (b << 1) | (parity << 9) | (1 << 10);
+    ps2.bit = 0;
+    ps2.phase = 0;
+    ps2.state = PS2_SENDING;
+    avr_cycle_timer_register(avr, ps2.delays[ps2.head], ps2Tick, NULL);
+}
+
+//
+static void ps2Queue(uint8_t b, avr_cycle_count_t delay) {
+    uint8_t ix = (ps2.head + ps2.count) % array_len(ps2.queue);
+    ps2.queue[ix] = b;
+    ps2.delays[ix] = delay;
+    ps2.count++;
+    ps2Next();
+}
+
+//
+static void ps2Command(uint8_t c) {
+    switch (c) {
+        case 0xff: // reset
+            ps2Queue(0xfa, PS2_BYTE_GAP);
+            ps2Queue(0xaa, PS2_BAT_DELAY);
+            break;
+        case 0xee: // echo
+            ps2Queue(0xee, PS2_BYTE_GAP);
+            break;
+        case 0xf2: // read ID
+            ps2Queue(0xfa, PS2_BYTE_GAP);
+            ps2Queue(0xab, PS2_BYTE_GAP);
+            ps2Queue(0x83, PS2_BYTE_GAP);
+            break;
+        default:
+            ps2Queue(0xfa, PS2_BYTE_GAP);
+            break;
+    }
+}
+
+// Sends a bit per three phases: set data, clock low, clock high.
+static void ps2SendStep(avr_cycle_count_t when) {
+
+    switch (ps2.phase) {
+
+        case 0:
+            if (firmwarePullsLow(PIN_PS2_CLOCK)) {
+                return; // host inhibits, retry later
+            }
+            ps2Data((ps2.frame >> ps2.bit) & 1);
+            ps2.phase = 1;
+            return;
+
+        case 1:
+            ps2Clock(false);
+            if (ps2.bit == 10) {
+                ps2.lastStop = when;
+            }
+            ps2.phase = 2;
+            return;
+
+        default:
+            ps2Clock(true);
+            ps2.phase = 0;
+            if (++ps2.bit == 11) {
+                ps2.head = (ps2.head + 1) % array_len(ps2.queue);
+                ps2.count--;
+                ps2.state = PS2_IDLE;
+            }
+    }
+}
+
+// Receives a command byte from the host. The device clocks in data, parity,
+// and stop bit on rising clock edges, then acknowledges by pulling data low
+// for one more clock pulse.
+static void ps2ReceiveStep() {
+
+    switch (ps2.phase) {
+
+        case 0:
+            if (ps2.bit == 10) {
+                ps2Data(false); // ack
+            }
+            ps2Clock(false);
+            ps2.phase = 1;
+            return;
+
+        default:
+            ps2Clock(true);
+            ps2.phase = 0;
+            if (ps2.bit < 10) {
+                if (!firmwarePullsLow(PIN_PS2_DATA)) {
+                    ps2.frame |= 1 << ps2.bit;
+                }
+                ps2.bit++;
+                return;
+            }
+            ps2Data(true);
+            ps2.state = PS2_IDLE;
+            ps2Command(ps2.frame & 0xff);
+    }
+}
+
+//
+static avr_cycle_count_t ps2Tick(avr_t *avr, avr_cycle_count_t when,
+    void *param) {
+
+    if (ps2.state == PS2_SENDING) {
+        ps2SendStep(when);
+    } else if (ps2.state == PS2_RECEIVING) {
+        ps2ReceiveStep();
+    }
+
+    if (ps2.state == PS2_IDLE) {
+        ps2Next();
+        return 0;
+    }
+
+    return when + PS2_HALF_BIT / 2;
+}
+
+// Watches for the host's request to send, i.e. data pulled low with clock
+// released. The host may also abort our sending by pulling clock low, in
+// which case the byte is sent again later.
+static void portDChanged() {
+
+    if (ps2.state == PS2_SENDING && ps2.bit > 0
+        && firmwarePullsLow(PIN_PS2_CLOCK)) {
+        avr_cycle_timer_cancel(avr, ps2Tick, NULL);
+        ps2Clock(true);
+        ps2Data(true);
+        ps2.state = PS2_IDLE;
+        return;
+    }
+
+    if (ps2.state == PS2_IDLE && firmwarePullsLow(PIN_PS2_DATA)
+        && !firmwarePullsLow(PIN_PS2_CLOCK)) {
+        avr_cycle_timer_cancel(avr, ps2Tick, NULL);
+        ps2.state = PS2_RECEIVING;
+        ps2.frame = 0;
+        ps2.bit = 0;
+        ps2.phase = 0;
+        avr_cycle_timer_register(avr, PS2_HALF_BIT, ps2Tick, NULL);
+    }
+}
+
+//
+static void ddrDChanged(avr_irq_t *irq, uint32_t value, void *param) {
+    ddrD = value;
+    portDChanged();
+}
+
+//
+static void portDWritten(avr_irq_t *irq, uint32_t value, void *param) {
+    portD = value;
+    portDChanged();
+}
+
+// Sends make or break code of key, and returns input edge.
+static avr_cycle_count_t ps2Key(const InputKey *k, bool make) {
+    if (k->extended) {
+        ps2Queue(0xe0, PS2_BYTE_GAP);
+    }
+    if (!make) {
+        ps2Queue(0xf0, PS2_BYTE_GAP);
+    }
+    ps2Queue(k->scan, PS2_BYTE_GAP);
+    while (ps2.count > 0 || ps2.state != PS2_IDLE) {
+        runFor(PS2_HALF_BIT);
+    }
+    return ps2.lastStop;
+}
+
+// --- serial & joystick ------------------------------------------------------
+
+// Sends a protocol version 1 frame, and returns input edge.
+static avr_cycle_count_t serialKey(const InputKey *k, bool make) {
+    avr_raise_irq(uartInIrq, make ? FRAME_MAKE : FRAME_BREAK);
+    avr_raise_irq(uartInIrq, k->code);
+    return avr->cycle + 2 * SERIAL_FRAME;
+}
+
+// Moves joystick up, which ignores the key. Returns input edge.
+static avr_cycle_count_t joystickKey(const InputKey *k, bool make) {
+    avr_raise_irq(joystickIrq[0], make ? 0 : 1);
+    return avr->cycle;
+}
+
+// --- measurement ------------------------------------------------------------
+
+typedef avr_cycle_count_t (*InputFunc)(const InputKey *k, bool make);
+
+static int repetitions = 16;
+
+//
+static void report(const char *source, KeyClass c, const char *input,
+    avr_cycle_count_t *samples, int n) {
+
+    if (n == 0) {
+        printf("%-9s %-6s %-11s no strobe\n", source, CLASS_NAMES[c], input);
+        return;
+    }
+
+    std::sort(samples, samples + n);
+    avr_cycle_count_t min = samples[0];
+    avr_cycle_count_t med = samples[n / 2];
+    avr_cycle_count_t max = samples[n - 1];
+
+    printf("%-9s %-6s %-11s %9llu %9llu %9llu   %8.1f %8.1f %8.1f\n",
+        source, CLASS_NAMES[c], input, (unsigned long long)min,
+        (unsigned long long)med, (unsigned long long)max,
+        (double)min / US, (double)med / US, (double)max / US);
+}
+
+//
+static void measure(const char *source, InputFunc in, KeyClass c,
+    const InputKey *k) {
+
+    avr_cycle_count_t samples[repetitions];
+    int n = 0;
+
+    for (int rep = 0; rep < repetitions; rep++) {
+
+        runFor(rep * PHASE_STEP);
+
+        avr_cycle_count_t edge;
+        if (c == CLASS_MACRO) {
+            in(k, true);
+            runFor(10 * MS);
+            arm();
+            edge = in(k, false);
+        } else {
+            arm();
+            edge = in(k, true);
+        }
+
+        if (waitForStrobe() && firstStrobe >= edge) {
+            samples[n++] = firstStrobe - edge;
+        }
+
+        if (c != CLASS_MACRO) {
+            in(k, false);
+        }
+        settle();
+    }
+
+    report(source, c, k->name, samples, n);
+}
+
+//
+static void usage() {
+    fprintf(stderr,
+        "\nusage: bench [-n {repetitions}] [-t {target name}] {firmware}\n\n"
+        "Runs the firmware ELF image under simavr, and measures cycles from\n"
+        "input edge to MT88xx strobe.\n\n");
+}
+
+//
+int main(int argc, char *argv[]) {
+
+    const char *target = "(default)";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:t:")) != -1) {
+        switch (opt) {
+            case 'n':
+                repetitions = atoi(optarg);
+                break;
+            case 't':
+                target = optarg;
+                break;
+            default:
+                usage();
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || repetitions < 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    elf_firmware_t f;
+    memset(&f, 0, sizeof(f));
+    if (elf_read_firmware(argv[optind], &f) != 0) {
+        fprintf(stderr, "cannot read firmware %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    avr = avr_make_mcu_by_name("atmega328p");
+    if (avr == NULL) {
+        fprintf(stderr, "simavr does not support atmega328p\n");
+        return EXIT_FAILURE;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &f);
+    avr->frequency = F_CPU;
+
+    // serial: don't echo firmware output to stdout
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+    uartInIrq = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+    // PS/2 & strobe
+    ps2ClockIrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'),
+        PIN_PS2_CLOCK);
+    ps2DataIrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'),
+        PIN_PS2_DATA);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'),
+        IOPORT_IRQ_DIRECTION_ALL), ddrDChanged, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'),
+        IOPORT_IRQ_REG_PORT), portDWritten, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'),
+        PIN_STROBE), strobeChanged, NULL);
+    ps2Clock(true);
+    ps2Data(true);
+
+    // joystick, all released
+    for (uint8_t ix = 0; ix < JOYSTICK_ACTIONS; ix++) {
+        joystickIrq[ix] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), ix);
+        avr_raise_irq(joystickIrq[ix], 1);
+    }
+
+    // let firmware start up and set up keyboard
+    runFor(EXTERNAL_KBD_RESET_TIMEOUT * MS);
+    settle();
+
+    printf("target: %s, F_CPU: %lu, repetitions: %d\n\n",
+        target, (unsigned long)F_CPU, repetitions);
+    printf("%-9s %-6s %-11s %9s %9s %9s   %8s %8s %8s\n", "source", "class",
+        "input", "min", "median", "max", "min us", "med us", "max us");
+
+    for (int c = CLASS_KEY; c < CLASS_NONE; c++) {
+        const InputKey *k = findKey((KeyClass)c);
+        if (k == NULL) {
+            printf("%-9s %-6s %-11s none in key map\n", "-",
+                CLASS_NAMES[c], "-");
+            continue;
+        }
+        measure("serial", serialKey, (KeyClass)c, k);
+        measure("PS/2", ps2Key, (KeyClass)c, k);
+    }
+
+    const InputKey up = {0, "UP", false, 0};
+    KeyClass c = classify(DEFAULT_MAP[0]);
+    if (c != CLASS_NONE) {
+        measure("joystick", joystickKey, c, &up);
+    }
+
+    return EXIT_SUCCESS;
+}
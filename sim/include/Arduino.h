@@ -0,0 +1,199 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Stand-in for the Arduino core when building the firmware for the host
+    simulator. It only covers what the firmware uses. Note that there's no
+    `Serial`, since the firmware has its own UART driver.
+ */
+
+#ifndef SIM_ARDUINO_h
+#define SIM_ARDUINO_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "avr/io.h"
+#include "avr/interrupt.h"
+#include "avr/pgmspace.h"
+#include "binary.h"
+
+// we're simulating an ATmega328P based Nano
+#define ARDUINO_ARCH_AVR
+#define F_CPU 16000000UL
+
+// cycle exact delays are meaningless on the host
+#define __builtin_avr_delay_cycles(n) ((void)(n))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW  0
+
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#define CHANGE  1
+#define FALLING 2
+#define RISING  3
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) \
+    ((p) == 2 ? 0 : ((p) == 3 ? 1 : NOT_AN_INTERRUPT))
+
+#define interrupts()   sei()
+#define noInterrupts() cli()
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// pin to port mapping, as in the AVR core
+#define PB 2
+#define PC 3
+#define PD 4
+
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+MockRegister *portInputRegister(uint8_t port);
+
+void attachInterrupt(uint8_t num, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t num);
+
+void setup();
+void loop();
+
+// --- String -----------------------------------------------------------------
+
+class String {
+
+public:
+    std::string s;
+
+    String() {}
+    String(const char *c) : s(c) {}
+    String(char c) : s(1, c) {}
+    String(unsigned char v, uint8_t base = DEC) { format(v, base); }
+    String(int v, uint8_t base = DEC) { format(v, base); }
+    String(unsigned int v, uint8_t base = DEC) { format(v, base); }
+    String(long v, uint8_t base = DEC) { format(v, base); }
+    String(unsigned long v, uint8_t base = DEC) { format(v, base); }
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+
+    String operator+(const String &o) const {
+        String r(*this);
+        r.s += o.s;
+        return r;
+    }
+
+private:
+    void format(long v, uint8_t base) {
+        char buf[36];
+        if (base == DEC) {
+            snprintf(buf, sizeof(buf), "%ld", v);
+        } else {
+            formatUnsigned(v, base, buf);
+        }
+        s = buf;
+    }
+
+    void format(unsigned long v, uint8_t base) {
+        char buf[36];
+        formatUnsigned(v, base, buf);
+        s = buf;
+    }
+
+    void format(int v, uint8_t base) { format((long)v, base); }
+    void format(unsigned int v, uint8_t b) { format((unsigned long)v, b); }
+    void format(unsigned char v, uint8_t b) { format((unsigned long)v, b); }
+
+    static void formatUnsigned(unsigned long v, uint8_t base, char *buf) {
+        char tmp[36];
+        int ix = 0;
+        do {
+            uint8_t d = v % base;
+            tmp[ix++] = d < 10 ? '0' + d : 'A' + d - 10;
+            v /= base;
+        } while (v > 0);
+        for (int o = 0; ix > 0; o++) {
+            buf[o] = tmp[--ix];
+            buf[o + 1] = '\0';
+        }
+    }
+};
+
+inline String operator+(const char *a, const String &b) {
+    return String(a) + b;
+}
+
+// --- Print ------------------------------------------------------------------
+
+class Print {
+
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+
+    virtual size_t write(const uint8_t *buf, size_t len) {
+        for (size_t ix = 0; ix < len; ix++) {
+            write(buf[ix]);
+        }
+        return len;
+    }
+
+    size_t write(const char *s) {
+        return write((const uint8_t *)s, strlen(s));
+    }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int b = DEC) { return print(String(v, b)); }
+    size_t print(int v, int b = DEC) { return print(String(v, b)); }
+    size_t print(unsigned int v, int b = DEC) { return print(String(v, b)); }
+    size_t print(long v, int b = DEC) { return print(String(v, b)); }
+    size_t print(unsigned long v, int b = DEC) { return print(String(v, b)); }
+
+    size_t println() { return write("\r\n"); }
+
+    template<typename T> size_t println(T v) {
+        size_t n = print(v);
+        return n + println();
+    }
+
+    template<typename T> size_t println(T v, int base) {
+        size_t n = print(v, base);
+        return n + println();
+    }
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SIM_AVR_INTERRUPT_h
+#define SIM_AVR_INTERRUPT_h
+
+#include "avr/io.h"
+
+// Interrupt vectors are plain functions, invoked by the simulator.
+#define ISR(vector, ...) \
+    extern "C" void vector(void); \
+    extern "C" void vector(void)
+
+inline void sei() {
+    SREG |= (1 << SREG_I);
+}
+
+inline void cli() {
+    SREG &= (uint8_t)~(1 << SREG_I);
+}
+
+#endif
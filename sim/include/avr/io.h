@@ -0,0 +1,106 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Registers & bit numbers of the ATmega328P, as far as used by the firmware.
+
+#ifndef SIM_AVR_IO_h
+#define SIM_AVR_IO_h
+
+#include "mock_register.h"
+
+// --- ports ------------------------------------------------------------------
+
+extern MockRegister PORTB, DDRB, PINB;
+extern MockRegister PORTC, DDRC, PINC;
+extern MockRegister PORTD, DDRD, PIND;
+
+// so that code can check for presence of a port, as it can on the MCU
+#define PORTB PORTB
+#define PORTC PORTC
+#define PORTD PORTD
+
+// --- status register --------------------------------------------------------
+
+extern MockRegister SREG;
+
+#define SREG_I 7
+
+// --- USART0 -----------------------------------------------------------------
+
+extern MockRegister UCSR0A, UCSR0B, UCSR0C, UDR0, UBRR0H, UBRR0L;
+
+#define MPCM0  0
+#define U2X0   1
+#define UPE0   2
+#define DOR0   3
+#define FE0    4
+#define UDRE0  5
+#define TXC0   6
+#define RXC0   7
+
+#define TXB80  0
+#define RXB80  1
+#define UCSZ02 2
+#define TXEN0  3
+#define RXEN0  4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+
+// --- pin change interrupts -------------------------------------------------
+
+extern MockRegister PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+#define PCIE0  0
+#define PCIE1  1
+#define PCIE2  2
+
+#define PCIF0  0
+#define PCIF1  1
+#define PCIF2  2
+
+// --- Timer1 -----------------------------------------------------------------
+
+extern MockRegister TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern MockCounter TCNT1;
+extern MockRegister16 OCR1B;
+
+#define CS10   0
+#define CS11   1
+#define CS12   2
+
+#define OCIE1B 2
+#define OCF1B  2
+
+// --- Timer2 -----------------------------------------------------------------
+
+extern MockRegister TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2;
+
+#define WGM20  0
+#define WGM21  1
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define WGM22  3
+#define TOIE2  0
+#define OCIE2A 1
+#define OCIE2B 2
+
+#endif
@@ -0,0 +1,35 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SIM_AVR_PGMSPACE_h
+#define SIM_AVR_PGMSPACE_h
+
+#include <stdint.h>
+#include <string.h>
+
+// there's only one address space on the host
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr)  (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)  (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr)   (*(void * const *)(addr))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SIM_MOCK_REGISTER_h
+#define SIM_MOCK_REGISTER_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    An I/O register of the simulated MCU. The firmware uses it just like the
+    real thing, while the simulator can observe writes & reads via hooks, e.g.
+    for modelling the MT88xx or the UART. The simulator itself accesses the
+    register content via `value`, which bypasses the hooks.
+ */
+class MockRegister {
+
+public:
+    typedef void (*WriteHook)(MockRegister &r, uint8_t old);
+    typedef uint8_t (*ReadHook)(MockRegister &r);
+
+    uint8_t value;
+    WriteHook onWrite;
+    ReadHook onRead;
+
+    MockRegister(uint8_t v = 0) : value(v), onWrite(NULL), onRead(NULL) {}
+    MockRegister(const MockRegister &) = delete;
+
+    operator uint8_t() {
+        return onRead != NULL ? onRead(*this) : value;
+    }
+
+    MockRegister &operator=(uint8_t v) {
+        uint8_t old = value;
+        value = v;
+        if (onWrite != NULL) {
+            onWrite(*this, old);
+        }
+        return *this;
+    }
+
+    MockRegister &operator=(MockRegister &r) {
+        return *this = (uint8_t)r;
+    }
+
+    MockRegister &operator|=(uint8_t v) {
+        return *this = (uint8_t)(*this | v);
+    }
+
+    MockRegister &operator&=(uint8_t v) {
+        return *this = (uint8_t)(*this & v);
+    }
+
+    MockRegister &operator^=(uint8_t v) {
+        return *this = (uint8_t)(*this ^ v);
+    }
+};
+
+/*
+    A 16 bit register the firmware writes and reads, such as OCR1B. There are
+    no hooks, the simulator uses `value`.
+ */
+class MockRegister16 {
+
+public:
+    uint16_t value;
+
+    MockRegister16(uint16_t v = 0) : value(v) {}
+    MockRegister16(const MockRegister16 &) = delete;
+
+    operator uint16_t() {
+        return value;
+    }
+
+    MockRegister16 &operator=(uint16_t v) {
+        value = v;
+        return *this;
+    }
+};
+
+/*
+    A 16 bit counter register, such as TCNT1, which the firmware only reads.
+    The simulator provides its content via the read hook.
+ */
+class MockCounter {
+
+public:
+    typedef uint16_t (*ReadHook)();
+
+    ReadHook onRead;
+
+    MockCounter() : onRead(NULL) {}
+    MockCounter(const MockCounter &) = delete;
+
+    operator uint16_t() {
+        return onRead != NULL ? onRead() : 0;
+    }
+};
+
+#endif
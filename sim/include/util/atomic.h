@@ -0,0 +1,39 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Same as avr-libc's, but on top of the mock status register.
+
+#ifndef SIM_UTIL_ATOMIC_h
+#define SIM_UTIL_ATOMIC_h
+
+#include "avr/interrupt.h"
+
+static inline uint8_t __iCliRetVal() {
+    cli();
+    return 1;
+}
+
+static inline void __iRestore(const uint8_t *s) {
+    SREG = *s;
+}
+
+#define ATOMIC_BLOCK(type) \
+    for (type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+
+#define ATOMIC_RESTORESTATE \
+    uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+
+#endif
@@ -0,0 +1,78 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "Arduino.h"
+#include "sim.h"
+
+//
+static void usage() {
+    fprintf(stderr,
+        "\nusage: spectratur-sim [-l {log file}] [-s {link}]\n\n"
+        "Runs the spectratur firmware on the host. The serial port is a\n"
+        "pseudo terminal, whose name is printed on start.\n\n"
+        "  -l  write MT88xx switch changes to this file instead of stdout\n"
+        "  -s  create a symbolic link to the serial port, e.g. for use\n"
+        "      with kev -p\n\n");
+}
+
+//
+static void stop(int) {
+    sim::stopRequested = 1;
+}
+
+//
+int main(int argc, char *argv[]) {
+
+    const char *link = NULL;
+    FILE *log = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hl:s:")) != -1) {
+        switch (opt) {
+            case 'l':
+                log = fopen(optarg, "w");
+                if (log == NULL) {
+                    perror("[sim] cannot open log file");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                link = optarg;
+                break;
+            default:
+                usage();
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    sim::initMcu();
+    if (!sim::initSerial(link)) {
+        return EXIT_FAILURE;
+    }
+    sim::initMt88xx(log);
+
+    setup();
+    for (;;) {
+        loop();
+    }
+}
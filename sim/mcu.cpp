@@ -0,0 +1,467 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "sim.h"
+
+// --- registers --------------------------------------------------------------
+
+MockRegister PORTB, DDRB, PINB(0xff);
+MockRegister PORTC, DDRC, PINC(0xff);
+MockRegister PORTD, DDRD, PIND(0xff);
+
+MockRegister SREG;
+
+MockRegister PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+MockRegister UCSR0A, UCSR0B, UCSR0C, UDR0, UBRR0H, UBRR0L;
+
+MockRegister TCCR1A, TCCR1B, TIMSK1, TIFR1;
+MockCounter TCNT1;
+MockRegister16 OCR1B;
+
+MockRegister TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2;
+
+// Vectors are defined by the firmware. They are weak here, so that the
+// simulator still links when the firmware doesn't use an interrupt.
+extern "C" {
+void PCINT1_vect(void) __attribute__((weak));
+void TIMER1_COMPB_vect(void) __attribute__((weak));
+void TIMER2_COMPA_vect(void) __attribute__((weak));
+void USART_RX_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+}
+
+// --- state ------------------------------------------------------------------
+
+volatile sig_atomic_t sim::stopRequested = 0;
+
+// how often interrupts from outside sources are checked for while the
+// firmware is busy, in ns
+static const uint64_t ASYNC_CHECK_INTERVAL = 20000;
+
+static const uint16_t TIMER1_PRESCALERS[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static const uint16_t TIMER2_PRESCALERS[] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+static uint64_t start = 0;
+static uint64_t lastAsyncCheck = 0;
+static bool inInterrupt = false;
+static unsigned long delivered = 0;
+
+static bool timerRunning = false;
+static uint64_t timerPeriod = 0;
+static uint64_t nextTick = 0;
+
+static int serialFd = -1;
+static uint8_t rxBuffer[256];
+static uint16_t rxLen = 0;
+static uint16_t rxPos = 0;
+static uint64_t rxNext = 0;
+
+void (*externalInterrupts[2])(void) = {NULL, NULL};
+
+// --- clock ------------------------------------------------------------------
+
+//
+static uint64_t monotonic() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+uint64_t sim::nanos() {
+    return monotonic() - start;
+}
+
+// --- interrupts -------------------------------------------------------------
+
+//
+static void call(void (*vector)(void)) {
+    if (vector != NULL) {
+        vector();
+        delivered++;
+    }
+}
+
+// Fires the Timer2 compare match interrupt for every tick that has passed.
+static void serviceTimer(uint64_t now) {
+
+    if (!timerRunning || !(TIMSK2.value & (1 << OCIE2A))) {
+        return;
+    }
+
+    if (now > nextTick + 100 * timerPeriod) {
+        nextTick = now; // we were suspended, don't try to catch up
+    }
+
+    while (now >= nextTick) {
+        call(TIMER2_COMPA_vect);
+        nextTick += timerPeriod;
+    }
+}
+
+// Fires the Timer1 compare match B interrupt once the counter has reached
+// OCR1B. The firmware only uses it for short one-off delays, so a match that
+// lies ahead by more than half the counter range counts as passed.
+static void serviceCompare() {
+    if ((TIMSK1.value & (1 << OCIE1B))
+        && (int16_t)((uint16_t)TCNT1 - OCR1B.value) >= 0) {
+        call(TIMER1_COMPB_vect);
+    }
+}
+
+// Duration of one frame on the serial line in ns, for 8N1.
+static uint64_t frameTime() {
+    uint16_t ubrr = (UBRR0H.value << 8) | UBRR0L.value;
+    uint8_t div = (UCSR0A.value & (1 << U2X0)) ? 8 : 16;
+    return 10ULL * div * (ubrr + 1) * 1000000000ULL / F_CPU;
+}
+
+// Hands received bytes to the UART, paced according to the baud rate.
+static void serviceReceiver(uint64_t now) {
+
+    if (!(UCSR0B.value & (1 << RXEN0))) {
+        return;
+    }
+
+    if (rxPos == rxLen) {
+        ssize_t n = read(serialFd, rxBuffer, sizeof(rxBuffer));
+        if (n <= 0) {
+            return;
+        }
+        rxLen = n;
+        rxPos = 0;
+    }
+
+    uint64_t t = frameTime();
+    if (rxNext + t < now) {
+        rxNext = now; // line was idle
+    }
+
+    while (rxPos < rxLen && rxNext <= now) {
+        if (UCSR0A.value & (1 << RXC0)) {
+            UCSR0A.value |= (1 << DOR0); // previous byte not read
+        }
+        UDR0.value = rxBuffer[rxPos++];
+        UCSR0A.value |= (1 << RXC0);
+        rxNext += t;
+        if (UCSR0B.value & (1 << RXCIE0)) {
+            call(USART_RX_vect);
+        }
+    }
+}
+
+//
+void sim::service(bool async) {
+
+    if (inInterrupt || !(SREG.value & (1 << SREG_I))) {
+        return;
+    }
+
+    // as on the MCU, interrupt handlers run with interrupts disabled
+    inInterrupt = true;
+    SREG.value &= ~(1 << SREG_I);
+
+    if (async) {
+        uint64_t now = nanos();
+        lastAsyncCheck = now;
+        serviceTimer(now);
+        serviceCompare();
+        serviceReceiver(now);
+    }
+
+    if ((PCICR.value & (1 << PCIE1)) && (PCIFR.value & (1 << PCIF1))) {
+        PCIFR.value &= ~(1 << PCIF1);
+        call(PCINT1_vect);
+    }
+
+    // Transmission is instantaneous, so data register empty is always set,
+    // and the interrupt keeps firing as long as it's enabled.
+    while ((UCSR0B.value & (1 << UDRIE0)) && USART_UDRE_vect != NULL) {
+        call(USART_UDRE_vect);
+    }
+
+    SREG.value |= (1 << SREG_I);
+    inInterrupt = false;
+}
+
+//
+static void serviceFromRegister() {
+    sim::service(sim::nanos() - lastAsyncCheck >= ASYNC_CHECK_INTERVAL);
+}
+
+//
+void sleep_cpu() {
+
+    unsigned long before = delivered;
+
+    while (delivered == before) {
+
+        if (sim::stopRequested) {
+            exit(EXIT_SUCCESS);
+        }
+
+        uint64_t now = sim::nanos();
+        uint64_t wait = 1000000000ULL;
+
+        if (timerRunning && (TIMSK2.value & (1 << OCIE2A))) {
+            uint64_t w = nextTick > now ? nextTick - now : 0;
+            wait = w < wait ? w : wait;
+        }
+
+        if (TIMSK1.value & (1 << OCIE1B)) {
+            uint16_t counts = OCR1B.value - (uint16_t)TCNT1;
+            uint16_t prescaler = TIMER1_PRESCALERS[TCCR1B.value & B00000111];
+            uint64_t w = (counts & 0x8000) ? 0
+                : (uint64_t)counts * prescaler * 1000000000ULL / F_CPU;
+            wait = w < wait ? w : wait;
+        }
+
+        bool pending = rxPos < rxLen;
+        if (pending) {
+            uint64_t w = rxNext > now ? rxNext - now : 0;
+            wait = w < wait ? w : wait;
+        }
+
+        if (wait > 0) {
+            struct pollfd pfd = {serialFd, (short)(pending ? 0 : POLLIN), 0};
+            struct timespec ts = {(time_t)(wait / 1000000000ULL),
+                (long)(wait % 1000000000ULL)};
+            ppoll(&pfd, serialFd >= 0 ? 1 : 0, &ts, NULL);
+        }
+
+        sim::service(true);
+    }
+}
+
+// --- register hooks ---------------------------------------------------------
+
+//
+static void sregWritten(MockRegister &r, uint8_t) {
+    if (r.value & (1 << SREG_I)) {
+        serviceFromRegister();
+    }
+}
+
+//
+static uint8_t sregRead(MockRegister &r) {
+    serviceFromRegister();
+    return r.value;
+}
+
+// Flags a pin change on port C, for inputs the simulator drives via PINC.
+static void pincWritten(MockRegister &r, uint8_t old) {
+    if ((r.value ^ old) & PCMSK1.value) {
+        PCIFR.value |= (1 << PCIF1);
+        serviceFromRegister();
+    }
+}
+
+// Interrupt flags are cleared by writing a 1.
+static void pcifrWritten(MockRegister &r, uint8_t old) {
+    r.value = old & ~r.value;
+}
+
+// Timer1 runs free from start-up, external clock sources are not supported
+static uint16_t tcnt1Read() {
+    uint16_t prescaler = TIMER1_PRESCALERS[TCCR1B.value & B00000111];
+    if (prescaler == 0) {
+        return 0;
+    }
+    return sim::nanos() * (F_CPU / 1000000UL) / 1000ULL / prescaler;
+}
+
+// restarts Timer2 whenever it gets reconfigured
+static void timer2Written(MockRegister &, uint8_t) {
+    uint16_t prescaler = TIMER2_PRESCALERS[TCCR2B.value & B00000111];
+    timerRunning = prescaler > 0;
+    timerPeriod = (uint64_t)(OCR2A.value + 1) * prescaler
+        * 1000000000ULL / F_CPU;
+    nextTick = sim::nanos() + timerPeriod;
+}
+
+// transmitter is always idle
+static uint8_t ucsr0aRead(MockRegister &r) {
+    return r.value | (1 << UDRE0) | (1 << TXC0);
+}
+
+//
+static uint8_t udr0Read(MockRegister &r) {
+    UCSR0A.value &= ~((1 << RXC0) | (1 << DOR0));
+    return r.value;
+}
+
+//
+static void udr0Written(MockRegister &r, uint8_t) {
+    if ((UCSR0B.value & (1 << TXEN0)) && serialFd >= 0) {
+        // Nobody may be listening, in which case data is lost, just as it
+        // would be on a real serial line.
+        if (write(serialFd, &r.value, 1) < 0 && errno != EAGAIN) {
+            perror("[sim] serial write");
+        }
+    }
+}
+
+//
+void sim::initMcu() {
+
+    start = monotonic();
+
+    SREG.onWrite = sregWritten;
+    SREG.onRead = sregRead;
+
+    PINC.onWrite = pincWritten;
+    PCIFR.onWrite = pcifrWritten;
+
+    TCNT1.onRead = tcnt1Read;
+
+    TCCR2B.onWrite = timer2Written;
+    OCR2A.onWrite = timer2Written;
+
+    UCSR0A.onRead = ucsr0aRead;
+    UDR0.onRead = udr0Read;
+    UDR0.onWrite = udr0Written;
+
+    // interrupts are enabled when setup() is called
+    SREG.value = (1 << SREG_I);
+}
+
+// --- serial -----------------------------------------------------------------
+
+//
+void sim::attachSerial(int fd) {
+    serialFd = fd;
+}
+
+// --- Arduino core -----------------------------------------------------------
+
+//
+unsigned long millis() {
+    return sim::nanos() / 1000000ULL;
+}
+
+//
+unsigned long micros() {
+    return sim::nanos() / 1000ULL;
+}
+
+// Interrupts keep getting served while waiting, as with the Arduino core.
+void delay(unsigned long ms) {
+    uint64_t end = sim::nanos() + ms * 1000000ULL;
+    while (sim::nanos() < end) {
+        usleep(100);
+        sim::service(true);
+    }
+}
+
+//
+void delayMicroseconds(unsigned int us) {
+    uint64_t end = sim::nanos() + us * 1000ULL;
+    while (sim::nanos() < end) {
+    }
+}
+
+// Returns port, direction, and input register for Arduino pin number, as
+// on the Nano.
+static uint8_t pinRegisters(uint8_t pin, MockRegister **port,
+    MockRegister **ddr, MockRegister **in) {
+    if (pin < 8) {
+        *port = &PORTD; *ddr = &DDRD; *in = &PIND;
+        return 1 << pin;
+    }
+    if (pin < 14) {
+        *port = &PORTB; *ddr = &DDRB; *in = &PINB;
+        return 1 << (pin - 8);
+    }
+    *port = &PORTC; *ddr = &DDRC; *in = &PINC;
+    return 1 << ((pin - 14) & 7);
+}
+
+//
+uint8_t digitalPinToPort(uint8_t pin) {
+    return pin < 8 ? PD : (pin < 14 ? PB : PC);
+}
+
+//
+uint8_t digitalPinToBitMask(uint8_t pin) {
+    MockRegister *port, *ddr, *in;
+    return pinRegisters(pin, &port, &ddr, &in);
+}
+
+//
+MockRegister *portInputRegister(uint8_t port) {
+    return port == PD ? &PIND : (port == PB ? &PINB : &PINC);
+}
+
+//
+void pinMode(uint8_t pin, uint8_t mode) {
+    MockRegister *port, *ddr, *in;
+    uint8_t mask = pinRegisters(pin, &port, &ddr, &in);
+    if (mode == OUTPUT) {
+        *ddr |= mask;
+    } else {
+        *ddr &= ~mask;
+        if (mode == INPUT_PULLUP) {
+            *port |= mask;
+        } else {
+            *port &= ~mask;
+        }
+    }
+}
+
+//
+void digitalWrite(uint8_t pin, uint8_t val) {
+    MockRegister *port, *ddr, *in;
+    uint8_t mask = pinRegisters(pin, &port, &ddr, &in);
+    if (val == LOW) {
+        *port &= ~mask;
+    } else {
+        *port |= mask;
+    }
+}
+
+// Output pins read back what was written, input pins what the simulated
+// outside world set in the PIN register.
+int digitalRead(uint8_t pin) {
+    MockRegister *port, *ddr, *in;
+    uint8_t mask = pinRegisters(pin, &port, &ddr, &in);
+    if (ddr->value & mask) {
+        return (port->value & mask) ? HIGH : LOW;
+    }
+    return (in->value & mask) ? HIGH : LOW;
+}
+
+// External interrupts are only recorded, nothing in the simulation drives
+// the pins yet.
+void attachInterrupt(uint8_t num, void (*isr)(void), int) {
+    if (num < 2) {
+        externalInterrupts[num] = isr;
+    }
+}
+
+//
+void detachInterrupt(uint8_t num) {
+    if (num < 2) {
+        externalInterrupts[num] = NULL;
+    }
+}
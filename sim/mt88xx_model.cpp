@@ -0,0 +1,92 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Model of the MT88xx switch matrix. It watches the port writes of the
+    firmware, and on each rising strobe edge latches address & data, just as
+    the chip does. Every change of a switch is logged with a time stamp in
+    microseconds since start of the simulation. The wiring needs to match
+    MT88xxBus in mt88xx.h.
+ */
+
+#include <string.h>
+
+#include "Arduino.h"
+#include "config.h"
+#include "sim.h"
+
+// PORTD
+static const uint8_t PIN_RESET  = B00100000;
+static const uint8_t PIN_DATA   = B01000000;
+static const uint8_t PIN_STROBE = B10000000;
+// PORTB
+static const uint8_t PINS_AX    = B00000111;
+static const uint8_t PINS_AY    = B00111000;
+// PORTC
+static const uint8_t PIN_AX3    = B00100000;
+
+static FILE *log = NULL;
+static uint8_t matrix[16];
+static unsigned long strobes = 0;
+static unsigned long changes = 0;
+
+//
+static void portDWritten(MockRegister &r, uint8_t old) {
+
+    uint8_t rising = r.value & ~old;
+
+    if (rising & PIN_RESET) {
+        memset(matrix, 0, sizeof(matrix));
+        fprintf(log, "%12.3f reset\n", sim::nanos() / 1000.0);
+    }
+
+    if (!(rising & PIN_STROBE)) {
+        return;
+    }
+
+    strobes++;
+
+    uint8_t ax = PORTB.value & PINS_AX;
+    if (MT88XX != 8808 && (PORTC.value & PIN_AX3)) {
+        ax |= B00001000;
+    }
+    uint8_t ay = (PORTB.value & PINS_AY) >> 3;
+    uint8_t bit = 1 << ay;
+    bool on = (r.value & PIN_DATA) != 0;
+
+    if (on == ((matrix[ax] & bit) != 0)) {
+        return;
+    }
+
+    matrix[ax] ^= bit;
+    changes++;
+    fprintf(log, "%12.3f AX %2d AY %d %s\n",
+        sim::nanos() / 1000.0, ax, ay, on ? "on" : "off");
+    fflush(log);
+}
+
+//
+static void summary() {
+    fprintf(stderr, "[sim] MT88xx: %lu strobes, %lu switch changes\n",
+        strobes, changes);
+}
+
+//
+void sim::initMt88xx(FILE *f) {
+    log = f;
+    PORTD.onWrite = portDWritten;
+    atexit(summary);
+}
@@ -0,0 +1,66 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// Kept apart from the rest of the simulator, since termios.h and the Arduino
+// binary constants don't mix.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+//
+bool sim::initSerial(const char *link) {
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+        perror("[sim] cannot open pseudo terminal");
+        return false;
+    }
+
+    const char *name = ptsname(fd);
+
+    // Keep slave side open, so that the master doesn't see a hang up while
+    // no client is connected. Also, no echo or line editing.
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror("[sim] cannot open pseudo terminal slave");
+        return false;
+    }
+    struct termios tty;
+    tcgetattr(slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    fprintf(stderr, "[sim] serial port: %s\n", name);
+
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            perror("[sim] cannot create link to serial port");
+            return false;
+        }
+        fprintf(stderr, "[sim] linked to: %s\n", link);
+    }
+
+    attachSerial(fd);
+    return true;
+}
@@ -0,0 +1,62 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Host simulation of the spectratur firmware. The firmware is compiled
+    against the mock Arduino core in `include`, and runs in real time. The
+    simulator delivers interrupts whenever the firmware enables them, or
+    sleeps, much like the MCU would. The UART is connected to a pseudo
+    terminal, so kev can talk to the simulated adapter, and a model of the
+    MT88xx logs every switch change with a time stamp.
+ */
+
+#ifndef SIM_h
+#define SIM_h
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace sim {
+
+// set by signal handler, to make the simulation stop at next sleep
+extern volatile sig_atomic_t stopRequested;
+
+// Sets up MCU registers & clock. Needs to be called first.
+void initMcu();
+
+// Opens a pseudo terminal and connects it to the UART. If link is not NULL,
+// a symbolic link to the terminal's slave device is created at that path.
+// Returns false if that fails.
+bool initSerial(const char *link);
+
+// Connects the UART to the given file descriptor.
+void attachSerial(int fd);
+
+// Attaches MT88xx model to the ports, logging switch changes to log.
+void initMt88xx(FILE *log);
+
+// Nanoseconds since start of simulation.
+uint64_t nanos();
+
+// Delivers pending interrupts, if interrupts are enabled. Interrupts from
+// outside sources, i.e. timer & UART receiver, are only checked if `async`
+// is set.
+void service(bool async);
+
+} // namespace sim
+
+#endif
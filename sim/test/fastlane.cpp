@@ -0,0 +1,95 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Checks the fast lane of the external keyboard: plain keys need to switch
+    right from the PS/2 ISR, before the main loop runs, while combos and lock
+    keys go through the main loop. A plain key arriving while a combo waits
+    for the main loop needs to be applied after the combo. Needs raw mode.
+ */
+
+#include "harness.h"
+
+#include "externalkbd.h"
+#include "targetkbd.h"
+
+static ExternalKbd *externalKbd;
+static TargetKbd *targetKbd;
+
+//
+static void send(std::initializer_list<uint8_t> codes) {
+    for (uint8_t c : codes) {
+        harness::ps2Send(c);
+    }
+}
+
+// runs the main loop part of the external keyboard
+static void process() {
+    for (int ix = 0; ix < 4; ix++) {
+        externalKbd->process(targetKbd, NULL);
+    }
+}
+
+//
+int main() {
+
+    harness::init();
+    targetKbd = new TargetKbd();
+    externalKbd = new ExternalKbd(harness::PS2_DATA, harness::PS2_IRQ);
+    externalKbd->enableFastLane(targetKbd);
+
+    send({0x1c});
+    harness::check(harness::switches() == "AX  1 AY 0 on\n",
+        "plain key make switches from ISR");
+    send({0xf0, 0x1c});
+    harness::check(harness::switches() == "AX  1 AY 0 off\n",
+        "plain key break switches from ISR");
+    process();
+    harness::check(harness::switches().empty(),
+        "main loop has nothing left to do for plain key");
+
+    // cursor up is a combo on all targets
+    send({0xe0, 0x75});
+    harness::check(harness::switches().empty(), "combo waits for main loop");
+    process();
+    std::string combo = harness::switches();
+    harness::check(!combo.empty(), "combo applied by main loop");
+    send({0xe0, 0xf0, 0x75});
+    process();
+    harness::switches();
+
+    // A sent right after deferred combo, without main loop in between
+    send({0xe0, 0x75});
+    send({0x1c});
+    harness::check(harness::switches().empty(),
+        "plain key after deferred combo waits for main loop");
+    process();
+    harness::check(harness::switches() == combo + "AX  1 AY 0 on\n",
+        "plain key after deferred combo applied after combo");
+    send({0xe0, 0xf0, 0x75, 0xf0, 0x1c});
+    process();
+    harness::switches();
+
+    send({0x58});
+    harness::check(harness::switches().empty(),
+        "lock key waits for main loop");
+    process();
+    uint8_t sent[4];
+    harness::check(harness::ps2Receive(sent, sizeof(sent)) == 2,
+        "lock key LED update");
+
+    return harness::done("fastlane");
+}
@@ -0,0 +1,147 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Helpers for the host checks in this directory. Each check is a program of
+    its own, built from the firmware sources together with the simulator, but
+    with its own `main` instead of `setup` & `loop`, see `sim-test` target in
+    the Makefile. A check prints what fails, and exits non-zero if anything
+    did.
+ */
+
+#ifndef HARNESS_h
+#define HARNESS_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Arduino.h"
+#include "sim.h"
+
+// PS/2 library internals driven by the checks
+void ps2interrupt(void);
+extern volatile uint8_t _ps2mode;
+extern volatile uint8_t _now_send;
+
+namespace harness {
+
+// pins as wired in spectratur.ino, data is PIND bit 4
+static const uint8_t PS2_DATA = 4;
+static const uint8_t PS2_IRQ = 3;
+// _TX_MODE flag of _ps2mode
+static const uint8_t PS2_TX_MODE = B01000000;
+
+// bit of PIND the keyboard's data line is driven on, see ps2Bit()
+static uint8_t ps2DataBit = PS2_DATA;
+static int failures = 0;
+static FILE *mtLog = NULL;
+static char *mtBuf = NULL;
+static size_t mtSize = 0;
+static size_t mtRead = 0;
+
+//
+static inline void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "[test] FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Reports the result, to be returned from main.
+static inline int done(const char *name) {
+    fprintf(stderr, "[test] %s: %s\n", name, failures ? "FAILED" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Sets up MCU, and captures the MT88xx switch changes for switches().
+static inline void init() {
+    sim::initMcu();
+    mtLog = open_memstream(&mtBuf, &mtSize);
+    sim::initMt88xx(mtLog);
+}
+
+// Returns the MT88xx switch changes since last call, one per line, without
+// time stamps, e.g. "AX  1 AY 0 on".
+static inline std::string switches() {
+    fflush(mtLog);
+    std::string ret;
+    for (size_t ix = mtRead; ix < mtSize; ) {
+        const char *line = mtBuf + ix;
+        const char *end = strchr(line, '\n');
+        size_t len = end ? end - line + 1 : mtSize - ix;
+        // skip time stamp, right aligned, and blank after it
+        const char *text = line + strspn(line, " ");
+        text += strcspn(text, " \n");
+        text += strspn(text, " ");
+        if (text < line + len) {
+            ret.append(text, line + len - text);
+        }
+        ix += len;
+    }
+    mtRead = mtSize;
+    return ret;
+}
+
+// Clocks one bit from the keyboard into the PS/2 ISR.
+static inline void ps2Bit(bool v) {
+    if (v) {
+        PIND |= 1 << ps2DataBit;
+    } else {
+        PIND &= ~(1 << ps2DataBit);
+    }
+    ps2interrupt();
+}
+
+// Clocks a byte from the keyboard into the PS/2 ISR, as start bit, eight
+// data bits, odd parity, and stop bit.
+static inline void ps2Send(uint8_t b) {
+    bool parity = true;
+    ps2Bit(false);
+    for (int ix = 0; ix < 8; ix++, b >>= 1) {
+        parity ^= b & 1;
+        ps2Bit(b & 1);
+    }
+    ps2Bit(parity);
+    ps2Bit(true);
+}
+
+// Clocks out the bytes the adapter is sending to the keyboard, if any, and
+// acknowledges each of them, as the keyboard would. Returns the number of
+// bytes sent, and stores up to max of them in buf.
+static inline int ps2Receive(uint8_t *buf, int max) {
+    int count = 0;
+    while (_ps2mode & PS2_TX_MODE) {
+        if (count < max) {
+            buf[count] = _now_send;
+        }
+        count++;
+        for (int ix = 0; ix < 12; ix++) {
+            ps2interrupt();
+        }
+        ps2Send(0xfa);
+    }
+    return count;
+}
+
+} // namespace harness
+
+// the firmware's sketch functions, not used by checks
+void setup() {}
+void loop() {}
+
+#endif
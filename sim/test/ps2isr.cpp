@@ -0,0 +1,74 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Checks the receive side of the PS/2 ISR: key decoding with the data pin
+    read directly from PS2_DATA_PIN_REG, and through digitalRead() for any
+    other pin, and resync after a stray partial byte followed by a gap longer
+    than the resync timeout.
+ */
+
+#include <unistd.h>
+
+#include "harness.h"
+
+#include "_PS2KeyAdvanced.h"
+
+extern bool _data_direct;
+
+static PS2KeyAdvanced keyboard;
+
+// returns next key from the library, 0 if there is none
+static uint16_t nextKey() {
+    return keyboard.available() ? keyboard.read() : 0;
+}
+
+// sends make & break of A, and checks that both arrive
+static void typeA(const char *what) {
+    harness::ps2Send(0x1c);
+    harness::ps2Send(0xf0);
+    harness::ps2Send(0x1c);
+    uint16_t make = nextKey();
+    uint16_t brk = nextKey();
+    harness::check((make & 0xff) == PS2_KEY_A && !(make & PS2_BREAK), what);
+    harness::check((brk & 0xff) == PS2_KEY_A && (brk & PS2_BREAK), what);
+    harness::check(nextKey() == 0, what);
+}
+
+//
+int main() {
+
+    // Timer1 is left to the library, which needs to start it
+    harness::init();
+
+    keyboard.begin(harness::PS2_DATA, harness::PS2_IRQ);
+    harness::check(_data_direct, "data pin 4 read directly");
+    typeA("decode with data pin read directly");
+
+    // stray partial byte, then gap beyond resync timeout
+    harness::ps2Bit(false);
+    harness::ps2Bit(true);
+    usleep(3000);
+    typeA("decode after resync");
+
+    // any other pin falls back to digitalRead()
+    harness::ps2DataBit = 5;
+    keyboard.begin(5, harness::PS2_IRQ);
+    harness::check(!_data_direct, "data pin 5 read with digitalRead()");
+    typeA("decode with data pin read with digitalRead()");
+
+    return harness::done("ps2isr");
+}
@@ -0,0 +1,79 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Clocks scan codes for plain, modifier, extended, repeated, and lock keys
+    into the PS/2 ISR, and prints the resulting MT88xx switch changes per key
+    stroke. This is built once in translated and once in raw mode, and the
+    outputs are compared, see `sim-test` target in the Makefile. Either way,
+    a lock key needs to get its LED updated.
+ */
+
+#include "harness.h"
+
+#include "externalkbd.h"
+#include "targetkbd.h"
+
+static ExternalKbd *externalKbd;
+static TargetKbd *targetKbd;
+
+// prints the switch changes caused by the given scan codes
+static void stroke(const char *name, std::initializer_list<uint8_t> codes) {
+    for (uint8_t c : codes) {
+        harness::ps2Send(c);
+    }
+    for (int ix = 0; ix < 4; ix++) {
+        externalKbd->process(targetKbd, NULL);
+    }
+    printf("-- %s\n%s", name, harness::switches().c_str());
+}
+
+//
+int main() {
+
+    harness::init();
+    targetKbd = new TargetKbd();
+    externalKbd = new ExternalKbd(harness::PS2_DATA, harness::PS2_IRQ);
+
+    stroke("A make", {0x1c});
+    stroke("A break", {0xf0, 0x1c});
+    stroke("left shift make", {0x12});
+    stroke("left shift break", {0xf0, 0x12});
+    stroke("up make", {0xe0, 0x75});
+    stroke("up break", {0xe0, 0xf0, 0x75});
+    stroke("print screen make", {0xe0, 0x12, 0xe0, 0x7c});
+    stroke("print screen break", {0xe0, 0xf0, 0x7c, 0xe0, 0xf0, 0x12});
+    stroke("enter make", {0x5a});
+    stroke("enter break", {0xf0, 0x5a});
+    stroke("space make", {0x29});
+    stroke("space repeat", {0x29});
+    stroke("space break", {0xf0, 0x29});
+
+    stroke("caps lock make", {0x58});
+    uint8_t sent[4];
+    int count = harness::ps2Receive(sent, sizeof(sent));
+    harness::check(count == 2 && sent[0] == 0xed && sent[1] == PS2_LOCK_CAPS,
+        "caps lock LED update");
+    stroke("caps lock break", {0xf0, 0x58});
+    harness::check(harness::ps2Receive(sent, sizeof(sent)) == 0,
+        "no LED update on caps lock break");
+
+    stroke("A make", {0x1c});
+    stroke("A break", {0xf0, 0x1c});
+
+    return harness::done(EXTERNAL_KBD_RAW ? "raw (raw mode)"
+        : "raw (translated mode)");
+}
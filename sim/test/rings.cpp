@@ -0,0 +1,90 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Checks what happens when the PS/2 receive ring overflows: with A held
+    down, more codes than the ring holds are sent without running the main
+    loop, so that the break of A gets lost. The loss needs to be counted, and
+    afterwards no key may stay pressed on the target. With the fast lane,
+    nothing gets buffered, so nothing may get lost. This is built for
+    translated mode, raw mode, and the fast lane.
+ */
+
+#include <set>
+
+#include "harness.h"
+
+#include "externalkbd.h"
+#include "targetkbd.h"
+
+static ExternalKbd *externalKbd;
+static TargetKbd *targetKbd;
+static std::set<std::string> pressed;
+
+// Runs the main loop part of the external keyboard, often enough to drain
+// the receive ring, and tracks switches.
+static void process() {
+    for (int ix = 0; ix < 2 * EXTERNAL_KBD_RX_BUFFER_SIZE; ix++) {
+        externalKbd->process(targetKbd, NULL);
+    }
+    std::string changes = harness::switches();
+    for (size_t pos = 0; pos < changes.size(); ) {
+        size_t end = changes.find('\n', pos);
+        std::string line = changes.substr(pos, end - pos);
+        size_t state = line.rfind(' ');
+        if (line.compare(state + 1, std::string::npos, "on") == 0) {
+            pressed.insert(line.substr(0, state));
+        } else {
+            pressed.erase(line.substr(0, state));
+        }
+        pos = end + 1;
+    }
+}
+
+//
+int main() {
+
+    harness::init();
+    targetKbd = new TargetKbd();
+    externalKbd = new ExternalKbd(harness::PS2_DATA, harness::PS2_IRQ);
+    if (EXTERNAL_KBD_FAST_LANE) {
+        externalKbd->enableFastLane(targetKbd);
+    }
+
+    harness::ps2Send(0x1c);
+    process();
+    harness::check(pressed.size() == 1, "A pressed");
+
+    for (int ix = 0; ix < 20; ix++) {
+        harness::ps2Send(0x29);
+    }
+    harness::ps2Send(0xf0);
+    harness::ps2Send(0x1c);
+    process();
+
+    PS2Stats stats;
+    externalKbd->getStats(&stats);
+    if (EXTERNAL_KBD_FAST_LANE) {
+        harness::check(stats.overflows == 0, "nothing lost with fast lane");
+        harness::check(pressed.size() == 1, "only space still pressed");
+    } else {
+        harness::check(stats.overflows > 0, "overflow counted");
+        harness::check(pressed.empty(), "all keys released after loss");
+    }
+
+    return harness::done(EXTERNAL_KBD_FAST_LANE ? "rings (fast lane)"
+        : EXTERNAL_KBD_RAW ? "rings (raw mode)" : "rings (translated mode)");
+}
@@ -0,0 +1,57 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Checks that the direct indexed scan code planes of the PS/2 library give
+    the same key codes as a linear scan of the pair tables they are generated
+    from, for every scan code.
+ */
+
+#include "harness.h"
+
+#include "_PS2KeyAdvanced.h"
+#include "_PS2KeyCode.h"
+#include "_PS2KeyTable.h"
+
+// first match wins, as with the linear scan translate() used to do
+static uint8_t linearScan(const uint8_t table[][2], size_t length,
+    uint8_t code) {
+    for (size_t ix = 0; ix < length; ix++) {
+        if (table[ix][0] == code) {
+            return table[ix][1];
+        }
+    }
+    return 0;
+}
+
+//
+int main() {
+
+    char what[64];
+
+    for (int code = 0; code < 256; code++) {
+
+        snprintf(what, sizeof(what), "single byte code 0x%02x", code);
+        harness::check(single_key_plane::read(code)
+            == linearScan(single_key, pair_count(single_key), code), what);
+
+        snprintf(what, sizeof(what), "E0 code 0x%02x", code);
+        harness::check(extended_key_plane::read(code)
+            == linearScan(extended_key, pair_count(extended_key), code), what);
+    }
+
+    return harness::done("scancodes");
+}
@@ -130,6 +130,10 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include <Arduino.h>
+// Time stamps for latency statistics, and buffer sizes from the application
+#include "latency.h"
+#define PS2_RX_BUFFER_SIZE   EXTERNAL_KBD_RX_BUFFER_SIZE
+#define PS2_KEY_BUFFER_SIZE  EXTERNAL_KBD_KEY_BUFFER_SIZE
 // Internal headers for library defines/codes/etc
 #include "_PS2KeyAdvanced.h"
 #include "_PS2KeyCode.h"
@@ -139,11 +143,38 @@
 // Private function declarations
 void send_bit( void );
 void send_now( uint8_t );
-int16_t send_next( void );
+void tx_poll( void );
+void tx_abort( void );
+int queue_command( uint8_t, uint8_t, uint8_t, uint8_t, PS2Callback );
+uint8_t command_reply( uint8_t );
+void command_done( uint8_t );
 void ps2_reset( void );
 uint8_t decode_key( uint8_t );
 void pininput( uint8_t );
-void set_lock( );
+int set_lock( PS2Callback );
+
+/* Read data pin as 0 or 1 in ISR, directly from port where possible, i.e.
+   if begin( ) found the data pin to be PS2_DATA_PIN_REG/BIT */
+#if defined( PS2_DATA_PIN_REG )
+#define _READ_DATA( )  ( _data_direct \
+                         ? ( ( PS2_DATA_PIN_REG & ( 1 << PS2_DATA_PIN_BIT ) ) ? 1 : 0 ) \
+                         : ( digitalRead( PS2_DataPin ) ? 1 : 0 ) )
+#else
+#define _READ_DATA( )  ( digitalRead( PS2_DataPin ) ? 1 : 0 )
+#endif
+
+/* Gap between clock edges in Timer1 counts, see latency.h, after which any
+   partly received byte is discarded. Bits of a byte come at least every
+   100us, so a gap of 2ms can only be left over from a glitch */
+#define _RESYNC_COUNTS  ( 2000 / LATENCY_TICK_US )
+
+/* Time clock is held low before sending a byte, in Timer1 counts. At least
+   100us, timed with compare B so nothing waits for it */
+#define _INHIBIT_COUNTS  ( 100 / LATENCY_TICK_US + 1 )
+
+/* Mask for codes as returned by readRaw, i.e. _ps2mode flags in top byte */
+#define _RAW_MASK  ( 0xFF | PS2_RAW_BREAK | PS2_RAW_RESPONSE \
+                     | PS2_RAW_E0 | PS2_RAW_E1 )
 
 /* Constant control functions to flags array
    in translated key code value order  */
@@ -169,34 +200,55 @@ volatile uint8_t _ps2mode;          /* _ps2mode contains
 
 /* volatile RX buffers and variables accessed via interrupt functions */
 volatile uint16_t _rx_buffer[ _RX_BUFFER_SIZE ];     // buffer for data from keyboard
+/* Single producer (IRQ) single consumer ring, so no locking needed */
 volatile uint8_t _head;              // _head = last byte written
-uint8_t _tail;                       // _tail = last byte read (not modified in IRQ ever)
+volatile uint8_t _tail;              // _tail = last byte read (not modified in IRQ ever)
+volatile uint8_t _rx_lost;           // set when codes lost, cleared by lost( )
+volatile PS2Stats _stats;            // receive error counters
+volatile uint16_t _rx_stamps[ _RX_BUFFER_SIZE ];     // time each entry was received
 volatile int8_t _bytes_expected;
 volatile uint8_t _bitcount;          // Main state variable and bit count for interrupts
 volatile uint8_t _shiftdata;
 volatile uint8_t _parity;
 
 /* TX variables */
-volatile uint8_t _tx_buff[ _TX_BUFFER_SIZE ];    // buffer for keyboard commands
-volatile uint8_t _tx_head;          // buffer write pointer
-volatile uint8_t _tx_tail;          // buffer read pointer
 volatile uint8_t _last_sent;        // last byte if resend requested
 volatile uint8_t _now_send;         // immediate byte to send
-volatile uint8_t _response_count;   // bytes expected in reply to next TX
-volatile uint8_t _tx_ready;         // TX status for type of send contains
-            /* _HANDSHAKE 0x80 = handshaking command (ECHO/RESEND)
-               _COMMAND   0x01 = other command processing */
+
+/* Command queue, head and tail only changed in main code, ISR works on
+   the command after _tail while it is started and not done */
+struct ps2_command {
+  uint8_t data[ 2 ];                // command byte and parameter if any
+  uint8_t length;                   // bytes to send, 1 or 2
+  uint8_t responses;                // bytes expected after last ACK
+  PS2Callback done;                 // completion callback or NULL
+};
+ps2_command _cmd_queue[ _CMD_QUEUE_SIZE ];
+uint8_t _cmd_head;                  // _cmd_head = last command queued
+uint8_t _cmd_tail;                  // _cmd_tail = last command completed
+uint16_t _cmd_since;                // millis( ) when current command got to front
+volatile uint8_t _cmd_state;        // see _CMD_ states
+volatile uint8_t _cmd_result;       // PS2_CMD_ result once _CMD_DONE
+volatile uint8_t _cmd_sent;         // bytes of current command ACKed
+volatile uint8_t _cmd_retries;      // resends of current byte
 
 /* Output key buffering */
 uint16_t _key_buffer[ _KEY_BUFF_SIZE ]; // Output Buffer for translated keys
 uint8_t _key_head;                      // Output buffer WR pointer
 uint8_t _key_tail;                      // Output buffer RD pointer
+uint16_t _key_stamps[ _KEY_BUFF_SIZE ]; // time each key was received
+uint16_t _translate_stamp;              // time of entry last translated
+uint16_t _read_stamp;                   // time of key last read
+bool ( *_raw_handler )( uint16_t ) = NULL;  // gets codes in ISR if set
 uint8_t _mode = 0;            // Mode for output buffer contains
           /* _NO_REPEATS 0x80 No repeat make codes for _CTRL, _ALT, _SHIFT, _GUI
              _NO_BREAKS  0x08 No break codes */
 
 // Arduino settings for pins and interrupts Needed to send data
 uint8_t PS2_DataPin;
+#if defined( PS2_DATA_PIN_REG )
+bool _data_direct = false;     // data pin is PS2_DATA_PIN_REG/BIT
+#endif
 uint8_t PS2_IrqPin;
 
 // Key decoding variables
@@ -217,19 +269,21 @@ if( _ps2mode & _TX_MODE )
   send_bit( );
 else
   {
-  static uint32_t prev_ms = 0;
-  uint32_t now_ms;
+  static uint16_t prev = 0;
+  uint16_t now;
   uint8_t val, ret;
 
-  val = digitalRead( PS2_DataPin );
-  /* timeout catch for glitches reset everything */
-  now_ms = millis( );
-  if( now_ms - prev_ms > 250 )
+  val = _READ_DATA( );
+  /* timeout catch for glitches reset everything
+     Timer1 wraps after about 262ms, so a glitch followed by a gap just that
+     long goes unnoticed, but then the next one will be caught */
+  now = Latency::now( );
+  if( uint16_t( now - prev ) > _RESYNC_COUNTS )
     {
     _bitcount = 0;
     _shiftdata = 0;
     }
-  prev_ms = now_ms;
+  prev = now;
   _bitcount++;             // Now point to next bit
   switch( _bitcount )
     {
@@ -257,8 +311,12 @@ else
     case 11: // Stop bit lots of spare time now
             if( _parity >= 0xFD )    // had parity error
               {
+              _stats.parityErrors++;
               send_now( PS2_KC_RESEND );    // request resend
-              _tx_ready |= _HANDSHAKE;
+              }
+            else if( _cmd_state == _CMD_WAIT_ACK && command_reply( _shiftdata ) )
+              {
+              // reply to queued command handled, nothing to save
               }
             else                    // Good so save byte in _rx_buffer
               {
@@ -268,23 +326,30 @@ else
                 _bytes_expected--;
               if( _bytes_expected <= 0 || ret & 4 )   // Save value ??
                 {
-                val = _head + 1;
-                if( val >= _RX_BUFFER_SIZE )
-                  val = 0;
-                if( val != _tail )
+                // Offer to raw handler first, unless codes are waiting
+                if( _raw_handler == NULL || _head != _tail
+                    || !_raw_handler( ( uint16_t( _ps2mode ) << 8
+                                        | _shiftdata ) & _RAW_MASK ) )
                   {
-                  // get last byte to save
-                  _rx_buffer[ val ] = uint16_t( _shiftdata );
-                  // save extra details
-                  _rx_buffer[ val ] |= uint16_t( _ps2mode ) << 8;
-                  _head = val;
+                  val = ( _head + 1 ) & _RX_MASK;
+                  if( val != _tail )
+                    {
+                    // get last byte to save
+                    _rx_buffer[ val ] = uint16_t( _shiftdata );
+                    // save extra details
+                    _rx_buffer[ val ] |= uint16_t( _ps2mode ) << 8;
+                    _rx_stamps[ val ] = now;
+                    _head = val;
+                    }
+                  else
+                    {           // buffer full code lost
+                    _stats.overflows++;
+                    _rx_lost = 1;
+                    }
                   }
                 }
               if( ret & 0x10 )              // Special command to send (ECHO/RESEND)
-                {
                 send_now( _now_send );
-                _tx_ready |= _HANDSHAKE;
-                }
               else
                 if( _bytes_expected <= 0 )  // Receive data finished
                   {
@@ -292,7 +357,9 @@ else
                   _ps2mode &= ~( _E0_MODE + _E1_MODE + _WAIT_RESPONSE + _BREAK_KEY );
                   _bytes_expected = 0;
                   _ps2mode &= ~_PS2_BUSY;
-                  send_next( );              // Check for more to send
+                  if( _cmd_state == _CMD_WAIT_DATA )   // command responses in
+                    command_done( _shiftdata == PS2_KC_ERROR
+                                  ? PS2_CMD_ERROR : PS2_CMD_OK );
                   }
               }
             _bitcount = 0;	            // end of byte
@@ -336,12 +403,15 @@ if( _ps2mode & _E1_MODE )
 
 switch( value )
    {
-   case 0:      // Buffer overrun Errors Reset modes and buffers
+   case 0:      // Buffer overrun Errors Reset modes, codes lost in keyboard
    case PS2_KC_OVERRUN:
+                _stats.overflows++;
+                _rx_lost = 1;
                 ps2_reset( );
                 state = 0xC;
                 break;
    case PS2_KC_RESEND:   // Resend last byte if we have sent something
+                _stats.resends++;
                 if( ( _ps2mode & _LAST_VALID ) )
                   {
                   _now_send = _last_sent;
@@ -353,7 +423,6 @@ switch( value )
    case PS2_KC_ERROR: // General error pass up but stop any sending or receiving
                 _bytes_expected = 0;
                 _ps2mode = 0;
-                _tx_ready = 0;
                 state = 0xE;
                 break;
    case PS2_KC_KEYBREAK:   // break Code - wait the final key byte
@@ -439,14 +508,8 @@ switch( _bitcount )
             _last_sent = _now_send;   // save in case of resend request
             _ps2mode |= _LAST_VALID;
             }
-          // clear modes to receive again
+          // clear modes to receive reply, stays busy until it is in
           _ps2mode &= ~_TX_MODE;
-          if( _tx_ready & _HANDSHAKE )      // If _HANDSHAKE done
-            _tx_ready &= ~_HANDSHAKE;
-          else                              // else we finished a command
-            _tx_ready &= ~_COMMAND;
-          if( !( _ps2mode & _WAIT_RESPONSE ) )   //  if not wait response
-            send_next( );                    // check anything else to queue up
           _bitcount = 0;	            // end of byte
           break;
   default: // in case of weird error and end of byte reception re-sync
@@ -458,13 +521,11 @@ switch( _bitcount )
 /* Takes a byte sets up variables and starts the data sending processes
    Starts the actual byte transmission
    calling code must make sure line is idle and able to send
-   Whilst this function adds long delays the process of the delays
-   will STOP the interrupt source (keyboard) externally when clock held low
-   _tx_ready contains 2 flags checked in this order
-    _HANDSHAKE   command sent as part of receiving e.g. ECHO, RESEND
-    _COMMAND     other commands not part of receiving
-  Main difference _bytes_expected is NOT altered in _HANDSHAKE mode
-  in command mode we update _bytes_expected with number of response bytes
+   Holding clock low will STOP the interrupt source (keyboard) externally,
+   the hold is ended by Timer1 compare B interrupt rather than waiting here,
+   so safe to call from interrupt handler. Called with interrupts disabled
+   Used for commands from queue, and for handshaking e.g. ECHO, RESEND where
+   _bytes_expected is NOT altered
 */
 void send_now( uint8_t command )
 {
@@ -478,13 +539,6 @@ _bitcount = 1;          // Normal processors
 _parity = 0;
 _ps2mode |= _TX_MODE + _PS2_BUSY;
 
-// Only do this if sending a command not from Handshaking
-if( !( _tx_ready & _HANDSHAKE ) && ( _tx_ready & _COMMAND ) )
-  {
-  _bytes_expected = _response_count;  // How many bytes command will generate
-  _ps2mode |= _WAIT_RESPONSE;
-  }
-
 // STOP interrupt handler 
 // Setting pin output low will cause interrupt before ready
 detachInterrupt( digitalPinToInterrupt( PS2_IrqPin ) );
@@ -498,8 +552,17 @@ delayMicroseconds( 10 );
 // set Clock LOW
 digitalWrite( PS2_IrqPin, LOW );
 // Essential for PS2 spec compliance
-// set clock low for 60us
-delayMicroseconds( 60 );
+// keep clock low for 100us, continued in compare interrupt
+OCR1B = Latency::now( ) + _INHIBIT_COUNTS;
+TIFR1 = ( 1 << OCF1B );
+TIMSK1 |= ( 1 << OCIE1B );
+}
+
+
+/* Ends clock hold started by send_now( ) */
+ISR( TIMER1_COMPB_vect )
+{
+TIMSK1 &= ~( 1 << OCIE1B );
 // Set data low - Start bit
 digitalWrite( PS2_DataPin, LOW );
 // set clock to input_pullup data stays output while writing to keyboard
@@ -510,87 +573,160 @@ attachInterrupt( digitalPinToInterrupt( PS2_IrqPin ), ps2interrupt, FALLING );
 }
 
 
-/* Send next byte/command from TX queue and start sending
-   Must be ready to send and idle
-   Assumes commands consist of 1 or more bytes and wait for response then may or
-   not be followed by further bytes to send with or without response
-    Checks
-    1/ Buffer empty return empty buffer
-    2/ Busy return busy (will be checked by interrupt routines later)
-    3/ Read next byte (next byte to send)
-    4/ Check if following byte(s) are command/data or response
-
-    Returns  1 if started transmission or queued
-            -134 if already busy
-            -2 if buffer empty
-
-    Note PS2_KEY_IGNORE is used to denote a byte(s) expected in response */
-int16_t send_next( void )
+/* Drives command queue from main code, called from available( ) and
+   readRaw( )
+    1/ Removes finished command and calls its callback
+    2/ Starts command at head of queue when line idle
+    3/ Aborts it when no reply in time, see _CMD_ timeouts
+   The ISR does the rest, sending further bytes on each ACK */
+void tx_poll( void )
 {
-uint8_t  i;
-int16_t  val;
-
-val = -1;
-// Check buffer not empty
-i = _tx_tail;
-if( i == _tx_head )
-  return -2;
+ps2_command *cmd;
+uint8_t command, result;
+uint16_t timeout;
+PS2Callback done;
 
-// set command bit in _tx_ready as another command to do
-_tx_ready |= _COMMAND;
+if( _cmd_head == _cmd_tail )
+  return;
+cmd = &_cmd_queue[ ( _cmd_tail + 1 ) & _CMD_MASK ];
 
-// Already item waiting to be sent or sending interrupt routines will call back
-if( _tx_ready & _HANDSHAKE )
-  return -134;
+if( _cmd_state == _CMD_DONE )
+  {
+  command = cmd->data[ 0 ];
+  result = _cmd_result;
+  done = cmd->done;
+  _cmd_tail = ( _cmd_tail + 1 ) & _CMD_MASK;
+  _cmd_since = millis( );
+  _cmd_state = _CMD_IDLE;
+  if( done != NULL )
+    done( command, result );
+  if( _cmd_head == _cmd_tail )
+    return;
+  cmd = &_cmd_queue[ ( _cmd_tail + 1 ) & _CMD_MASK ];
+  }
 
-// if busy let interrupt catch and call us again
-if( _ps2mode & _PS2_BUSY )
-  return -134;
+timeout = ( cmd->length + 1 ) * _CMD_BYTE_TIMEOUT;
+if( cmd->responses )
+  timeout += _CMD_RESPONSE_TIMEOUT;
 
-// Following only accessed when not receiving or sending protocol bytes
-// Scan for command response and expected bytes to follow
-_response_count = 0;
-do
+ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
   {
-  i++;
-  if( i >= _TX_BUFFER_SIZE )
-    i = 0;
-  if( val == -1 )
-    val = _tx_buff[ i ];
+  if( _cmd_state == _CMD_IDLE && !( _ps2mode & _PS2_BUSY ) )
+    {
+    _cmd_sent = 0;
+    _cmd_retries = 0;
+    _cmd_state = _CMD_WAIT_ACK;
+    send_now( cmd->data[ 0 ] );
+    }
   else
-    if( _tx_buff[ i ] != PS2_KEY_IGNORE )
-      break;
-    else
-      _response_count++;
-  _tx_tail = i;
+    if( _cmd_state != _CMD_DONE
+        && uint16_t( millis( ) ) - _cmd_since > timeout )
+      {     // also when never started, line stuck busy
+      tx_abort( );
+      command_done( PS2_CMD_TIMEOUT );  // reported on next call
+      }
   }
-while( i != _tx_head );
-// Now know what to send and expect start the actual wire sending
-send_now( val );
-return 1;
 }
 
 
-/*  Send a byte to the TX buffer
-    Value in buffer of PS2_KEY_IGNORE signifies wait for response,
-    use one for each byte expected
+/* Abort sending or waiting for reply, release lines and receive again
+   Any partly received code is lost. Called with interrupts disabled */
+void tx_abort( void )
+{
+TIMSK1 &= ~( 1 << OCIE1B );
+pininput( PS2_DataPin );
+pininput( PS2_IrqPin );
+attachInterrupt( digitalPinToInterrupt( PS2_IrqPin ), ps2interrupt, FALLING );
+_bitcount = 0;
+_bytes_expected = 0;
+_ps2mode = 0;
+}
 
-    Returns -4 - if buffer full (buffer overrun not written)
-    Returns 1 byte written when done */
-int send_byte( uint8_t val )
+
+/* Add command to queue, started by tx_poll( )
+   length is 1 for command only or 2 with parameter
+   responses is bytes keyboard sends after ACK, saved in _rx_buffer
+
+   Returns -4 - if queue full
+   Returns 0 command queued */
+int queue_command( uint8_t command, uint8_t param, uint8_t length,
+                   uint8_t responses, PS2Callback done )
 {
-uint8_t ret;
+ps2_command *cmd;
+uint8_t i;
+
+i = ( _cmd_head + 1 ) & _CMD_MASK;
+if( i == _cmd_tail )
+  return -4;
+cmd = &_cmd_queue[ i ];
+cmd->data[ 0 ] = command;
+cmd->data[ 1 ] = param;
+cmd->length = length;
+cmd->responses = responses;
+cmd->done = done;
+if( _cmd_head == _cmd_tail )  // queue was empty, timeout starts now
+  _cmd_since = millis( );
+_cmd_head = i;
+return 0;
+}
 
-ret = _tx_head + 1;
-if( ret >= _TX_BUFFER_SIZE )
-  ret = 0;
-if( ret != _tx_tail )
+
+/* Handle byte received while waiting for ACK of command byte, from ISR
+   Sends next byte of command on ACK, or resends on request
+
+   Returns 1 if byte was reply to command
+           0 anything else to process as usual e.g. key code */
+uint8_t command_reply( uint8_t value )
+{
+ps2_command *cmd;
+
+cmd = &_cmd_queue[ ( _cmd_tail + 1 ) & _CMD_MASK ];
+switch( value )
   {
-  _tx_buff[ ret ] = val;
-  _tx_head = ret;
-  return 1;
+  case PS2_KC_ECHO:   // ECHO command is acknowledged with ECHO
+                if( cmd->data[ 0 ] != PS2_KC_ECHO )
+                  return 0;
+                // fall through
+  case PS2_KC_ACK:
+                _cmd_sent++;
+                _cmd_retries = 0;
+                if( _cmd_sent < cmd->length )
+                  send_now( cmd->data[ _cmd_sent ] );
+                else
+                  if( cmd->responses )
+                    {      // responses saved with _WAIT_RESPONSE
+                    _bytes_expected = cmd->responses;
+                    _ps2mode |= _WAIT_RESPONSE;
+                    _cmd_state = _CMD_WAIT_DATA;
+                    }
+                  else
+                    {
+                    _ps2mode &= ~_PS2_BUSY;
+                    command_done( PS2_CMD_OK );
+                    }
+                return 1;
+  case PS2_KC_RESEND:
+                _stats.resends++;
+                if( ++_cmd_retries <= _CMD_RETRIES )
+                  {
+                  send_now( cmd->data[ _cmd_sent ] );
+                  return 1;
+                  }
+                // fall through
+  case PS2_KC_ERROR:
+                _ps2mode &= ~_PS2_BUSY;
+                command_done( PS2_CMD_ERROR );
+                return 1;
   }
-return -4;
+return 0;
+}
+
+
+/* Mark current command finished, tx_poll( ) calls callback */
+void command_done( uint8_t result )
+{
+_cmd_result = result;
+_cmd_state = _CMD_DONE;
 }
 
 
@@ -609,12 +745,6 @@ pinMode( pin, INPUT );
 void ps2_reset( void )
 {
 /* reset buffers and states */
-_tx_head = 0;
-_tx_tail = 0;
-_tx_ready = 0;
-_response_count = 0;
-_head = 0;
-_tail = 0;
 _bitcount = 0;
 PS2_keystatus = 0;
 PS2_led_lock = 0;
@@ -624,12 +754,7 @@ _ps2mode = 0;
 
 uint8_t key_available( )
 {
-int8_t  i;
-
-i = _head - _tail;
-if( i < 0 )
-  i += _RX_BUFFER_SIZE;
-return uint8_t( i );
+return ( _head - _tail ) & _RX_MASK;
 }
 
 
@@ -644,7 +769,7 @@ return uint8_t( i );
     */
 uint16_t translate( void )
 {
-uint8_t   index, length, data;
+uint8_t   index, data;
 uint16_t  retdata;
 
 // get next character
@@ -653,10 +778,9 @@ index = _tail;
 // check for empty buffer
 if( index == _head )
   return 0;
-index++;
-if( index >= _RX_BUFFER_SIZE )
-  index = 0;
+index = ( index + 1 ) & _RX_MASK;
 _tail = index;
+_translate_stamp = _rx_stamps[ index ];
 // Get the flags byte break modes etc in this order
 data = _rx_buffer[ index ] & 0xFF;
 index = ( _rx_buffer[ index ] & 0xFF00 ) >> 8;
@@ -677,43 +801,11 @@ if( index & _BREAK_KEY )
 else
   PS2_keystatus &= ~_BREAK;
 
-retdata = 0;    // error code by default
-// Scan appropriate table
+// Look up in appropriate plane, 0 is error code for not found
 if( index & _E0_MODE )
-  {
-  length = sizeof( extended_key ) / sizeof( extended_key[ 0 ] );
-  for( index = 0; index < length; index++ )
-#if defined( PS2_REQUIRES_PROGMEM )
-     if( data == pgm_read_byte( &extended_key[ index ][ 0 ] ) )
-       {
-       retdata = pgm_read_byte( &extended_key[ index ][ 1 ] );
-#else
-     if( data == extended_key[ index ][ 0 ] )
-       {
-       retdata = extended_key[ index ][ 1 ];
-#endif
-       break;
-       }
-  }
+  retdata = extended_key_plane::read( data );
 else
-  {
-  length = sizeof( single_key ) / sizeof( single_key[ 0 ] );
-  for( index = 0; index < length; index++ )
-#if defined( PS2_REQUIRES_PROGMEM )
-     if( data == pgm_read_byte( &single_key[ index ][ 0 ] ) )
-       {
-       retdata = pgm_read_byte( &single_key[ index ][ 1 ] );
-#else
-     if( data == single_key[ index ][ 0 ] )
-       {
-       retdata = single_key[ index ][ 1 ];
-#endif
-       break;
-       }
-  }
-// trap not found key
-if( index == length )
-  retdata = 0;
+  retdata = single_key_plane::read( data );
 /* valid found values only */
 if( retdata > 0 )
   {
@@ -753,7 +845,7 @@ if( retdata > 0 )
           }
         else
           PS2_led_lock |= index;
-        set_lock( );
+        set_lock( NULL );
         }
       }
     }
@@ -797,49 +889,60 @@ return ( retdata | ( (uint16_t)PS2_keystatus << 8 ) );
 
 
 /* Build command to send lock status
-    Assumes data is within range */
-void set_lock( )
+    Assumes data is within range
+    Updates queued lock command not yet started instead, if any with same
+    callback, so only latest status gets sent */
+int set_lock( PS2Callback done )
 {
-send_byte( PS2_KC_LOCK );        // send command
-send_byte( PS2_KEY_IGNORE );     // wait ACK
-send_byte( PS2_led_lock );       // send data from internal variable
-if( ( send_byte( PS2_KEY_IGNORE ) ) ) // wait ACK
-  send_next( );              // if idle start transmission
+ps2_command *cmd;
+
+cmd = &_cmd_queue[ _cmd_head ];
+if( _cmd_head != _cmd_tail && cmd->data[ 0 ] == PS2_KC_LOCK
+    && cmd->done == done
+    && ( _cmd_head != ( ( _cmd_tail + 1 ) & _CMD_MASK )
+         || _cmd_state == _CMD_IDLE ) )
+  {
+  cmd->data[ 1 ] = PS2_led_lock;
+  return 0;
+  }
+return queue_command( PS2_KC_LOCK, PS2_led_lock, 2, 0, done );
 }
 
 
 /*  Send echo command to keyboard
-    returned data in keyboard buffer read as keys */
-void PS2KeyAdvanced::echo( void )
+    keyboard echo is taken as ACK */
+int PS2KeyAdvanced::echo( PS2Callback done )
 {
-send_byte( PS2_KC_ECHO );             // send command
-if( ( send_byte( PS2_KEY_IGNORE ) ) ) // wait data PS2_KC_ECHO
-  send_next( );                   // if idle start transmission
+int ret;
+
+ret = queue_command( PS2_KC_ECHO, 0, 1, 0, done );
+tx_poll( );                           // if idle start transmission
+return ret;
 }
 
 
 /*  Get the ID used in keyboard
     returned data in keyboard buffer read as keys */
-void PS2KeyAdvanced::readID( void )
+int PS2KeyAdvanced::readID( PS2Callback done )
 {
-send_byte( PS2_KC_READID );           // send command
-send_byte( PS2_KEY_IGNORE );          // wait ACK
-send_byte( PS2_KEY_IGNORE );          // wait data
-if( ( send_byte( PS2_KEY_IGNORE ) ) ) // wait data
-  send_next( );                   // if idle start transmission
+int ret;
+
+ret = queue_command( PS2_KC_READID, 0, 1, 2, done );  // ACK and 2 data
+tx_poll( );                           // if idle start transmission
+return ret;
 }
 
 
 /*  Get the current Scancode Set used in keyboard
     returned data in keyboard buffer read as keys */
-void PS2KeyAdvanced::getScanCodeSet( void )
+int PS2KeyAdvanced::getScanCodeSet( PS2Callback done )
 {
-send_byte( PS2_KC_SCANCODE );         // send command
-send_byte( PS2_KEY_IGNORE );          // wait ACK
-send_byte( 0 );                       // send data 0 = read
-send_byte( PS2_KEY_IGNORE );          // wait ACK
-if( ( send_byte( PS2_KEY_IGNORE ) ) ) // wait data
-  send_next( );                   // if idle start transmission
+int ret;
+
+// data 0 = read, ACK after each byte then data
+ret = queue_command( PS2_KC_SCANCODE, 0, 2, 1, done );
+tx_poll( );                           // if idle start transmission
+return ret;
 }
 
 
@@ -851,13 +954,17 @@ return( PS2_led_lock );
 
 
 /* Sets the current status of Locks and LEDs */
-void PS2KeyAdvanced::setLock( uint8_t code )
+int PS2KeyAdvanced::setLock( uint8_t code, PS2Callback done )
 {
+int ret;
+
 code &= 0xF;                // To allow for rare keyboards with extra LED
 PS2_led_lock = code;        // update our lock copy
 PS2_keystatus &= ~_CAPS;    // Update copy of _CAPS lock as well
 PS2_keystatus |= ( code & PS2_LOCK_CAPS ) ? _CAPS : 0;
-set_lock( );
+ret = set_lock( done );
+tx_poll( );                 // if idle start transmission
+return ret;
 }
 
 
@@ -882,15 +989,17 @@ _mode |= data ? _NO_REPEATS : 0;
 
 /* Resets keyboard when reset has completed
    keyboard sends AA - Pass or FC for fail        */
-void PS2KeyAdvanced::resetKey( )
+int PS2KeyAdvanced::resetKey( PS2Callback done )
 {
-send_byte( PS2_KC_RESET );            // send command
-send_byte( PS2_KEY_IGNORE );          // wait ACK
-if( ( send_byte( PS2_KEY_IGNORE ) ) ) // wait data PS2_KC_BAT or PS2_KC_ERROR
-  send_next( );                        // if idle start transmission
+int ret;
+
+// wait ACK then data PS2_KC_BAT or PS2_KC_ERROR
+ret = queue_command( PS2_KC_RESET, 0, 1, 1, done );
+tx_poll( );                           // if idle start transmission
 // LEDs and KeyStatus Reset too... to match keyboard
 PS2_led_lock = 0;
 PS2_keystatus = 0;
+return ret;
 }
 
 
@@ -901,21 +1010,21 @@ PS2_keystatus = 0;
                 default in keyboard is 0xB (10.9 CPS)
     Second Parameter delay is 0 - 3 for 0.25s to 1s in 0.25 increments
         default in keyboard is 1 = 0.5 second delay
-    Returned data in keyboard buffer read as keys
 
     Error returns 0 OK
+                -4 command queue full
                 -5 parameter error
                 */
-int PS2KeyAdvanced::typematic( uint8_t rate, uint8_t delay )
+int PS2KeyAdvanced::typematic( uint8_t rate, uint8_t delay, PS2Callback done )
 {
+int ret;
+
 if( rate > 31 || delay > 3 )
   return -5;
-send_byte( PS2_KC_RATE );             // send command
-send_byte( PS2_KEY_IGNORE );          // wait ACK
-send_byte( ( delay << 5 ) + rate );   // Send values
-if( ( send_byte( PS2_KEY_IGNORE ) ) ) // wait ACK
-  send_next( );                   // if idle start transmission
-return 0;
+// Send values, ACK after each byte
+ret = queue_command( PS2_KC_RATE, ( delay << 5 ) + rate, 2, 0, done );
+tx_poll( );                       // if idle start transmission
+return ret;
 }
 
 
@@ -931,16 +1040,18 @@ return 0;
             1 to buffer size less 1 as 1 to full buffer
 
   As with other ring buffers here when pointers match
-  buffer empty so cannot actually hold buffer size values  */
+  buffer empty so cannot actually hold buffer size values
+
+  Also drives the command queue, see tx_poll( ) */
 uint8_t PS2KeyAdvanced::available( )
 {
-int8_t  i, idx;
+uint8_t  i, idx;
 uint16_t data;
 
+tx_poll( );
+
 // check output queue
-i = _key_head - _key_tail;
-if( i < 0 )
-  i += _KEY_BUFF_SIZE;
+i = ( _key_head - _key_tail ) & _KEY_MASK;
 while( i < ( _KEY_BUFF_SIZE - 1 ) ) // process if not full
   if( key_available( ) )         // not check for more keys to process
     {
@@ -950,10 +1061,9 @@ while( i < ( _KEY_BUFF_SIZE - 1 ) ) // process if not full
     if( ( data & 0xFF ) != PS2_KEY_IGNORE
             && ( data & 0xFF ) > 0 )
       {
-      idx = _key_head + 1;         // point to next space
-      if( idx >= _KEY_BUFF_SIZE )  // loop to front if necessary
-        idx = 0;
+      idx = ( _key_head + 1 ) & _KEY_MASK;  // point to next space
       _key_buffer[ idx ] = data; // save the data to out buffer
+      _key_stamps[ idx ] = _translate_stamp;
       _key_head = idx;
       i++;                      // update count
       }
@@ -973,17 +1083,87 @@ uint8_t idx;
 
 if( ( result = available( ) ) )
   {
-  idx = _key_tail;
-  idx++;
-  if( idx >= _KEY_BUFF_SIZE )  // loop to front if necessary
-    idx = 0;
+  idx = ( _key_tail + 1 ) & _KEY_MASK;
   _key_tail = idx;
   result = _key_buffer[ idx ];
+  _read_stamp = _key_stamps[ idx ];
   }
 return result;
 }
 
 
+/* read next code from the keyboard buffer without translation
+   status bits of the _ps2mode flags match PS2_RAW_ masks
+   also drives the command queue, see tx_poll( )
+   returns 0 for empty buffer */
+uint16_t PS2KeyAdvanced::readRaw( )
+{
+uint8_t idx;
+
+tx_poll( );
+idx = _tail;
+if( idx == _head )
+  return 0;
+idx = ( idx + 1 ) & _RX_MASK;
+_tail = idx;
+_read_stamp = _rx_stamps[ idx ];
+return _rx_buffer[ idx ] & _RAW_MASK;
+}
+
+
+/* Returns and clears flag for codes lost since last call */
+bool PS2KeyAdvanced::lost( )
+{
+bool ret;
+
+ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+  {
+  ret = _rx_lost;
+  _rx_lost = 0;
+  }
+return ret;
+}
+
+
+/* Copy receive error counters */
+void PS2KeyAdvanced::getStats( PS2Stats *stats )
+{
+ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+  {
+  stats->overflows = _stats.overflows;
+  stats->parityErrors = _stats.parityErrors;
+  stats->resends = _stats.resends;
+  }
+}
+
+
+/* Clear receive error counters */
+void PS2KeyAdvanced::resetStats( )
+{
+ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+  {
+  _stats.overflows = 0;
+  _stats.parityErrors = 0;
+  _stats.resends = 0;
+  }
+}
+
+
+/* Set handler for codes in raw format called from ISR */
+void PS2KeyAdvanced::setRawHandler( bool ( *handler )( uint16_t ) )
+{
+_raw_handler = handler;
+}
+
+
+/* Returns the time at which the key last returned by read( ) or readRaw( )
+   was received, as given by Latency::now( ) */
+uint16_t PS2KeyAdvanced::lastStamp( )
+{
+return _read_stamp;
+}
+
+
 PS2KeyAdvanced::PS2KeyAdvanced( )
 {
 // nothing to do here, begin( ) does it all
@@ -995,9 +1175,21 @@ void PS2KeyAdvanced::begin( uint8_t data_pin, uint8_t irq_pin )
 {
 /* PS2 variables reset */
 ps2_reset( );
+_head = 0;
+_tail = 0;
+_cmd_head = 0;
+_cmd_tail = 0;
+_cmd_state = _CMD_IDLE;
 
 PS2_DataPin = data_pin;
 PS2_IrqPin = irq_pin;
+#if defined( PS2_DATA_PIN_REG )
+_data_direct = portInputRegister( digitalPinToPort( data_pin ) ) == &PS2_DATA_PIN_REG
+               && digitalPinToBitMask( data_pin ) == ( 1 << PS2_DATA_PIN_BIT );
+#endif
+
+// Timer1 time base for resync and clock inhibit, see send_now( )
+Latency::startTimer( );
 
 // initialize the pins
 pininput( PS2_IrqPin );            /* Setup Clock pin */
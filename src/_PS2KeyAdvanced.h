@@ -155,6 +155,16 @@
 #define PS2_CLEAR_PENDING_IRQ   1
 #endif
  
+// Data pin input register and bit, for AVR only. The interrupt handler
+// reads the data pin straight from its port, so it is fixed at compile time.
+// begin( ) checks that it matches the data pin passed in, and otherwise falls
+// back to the slower digitalRead( ). Default is PD4, which is pin 4 on Uno
+// and Nano.
+#if defined( ARDUINO_ARCH_AVR ) && !defined( PS2_DATA_PIN_REG )
+#define PS2_DATA_PIN_REG        PIND
+#define PS2_DATA_PIN_BIT        4
+#endif
+
 // Invalid architecture
 #if !( defined( PS2_SUPPORTED ) )
 #warning Library is NOT supported on this board Use at your OWN risk
@@ -170,6 +180,28 @@
 #define PS2_GUI      0x200
 #define PS2_FUNCTION 0x100
 
+/* Receive error counters */
+struct PS2Stats {
+  uint16_t overflows;     // codes lost in receive buffer or keyboard
+  uint16_t parityErrors;  // bytes with parity error, resend requested
+  uint16_t resends;       // resend requests from keyboard
+};
+
+/* Results passed to command completion callbacks */
+#define PS2_CMD_OK       0
+#define PS2_CMD_ERROR    1    // keyboard replied error or kept asking resend
+#define PS2_CMD_TIMEOUT  2    // no reply from keyboard in time
+
+/* Command completion callback, gets command code and result. Called from
+   available( ) or readRaw( ), not from the interrupt handler */
+typedef void ( *PS2Callback )( uint8_t, uint8_t );
+
+/* Flags/bit masks for status bits in value returned by readRaw */
+#define PS2_RAW_BREAK     0x2000
+#define PS2_RAW_RESPONSE  0x1000
+#define PS2_RAW_E0        0x800
+#define PS2_RAW_E1        0x400
+
 /* General defines of communications codes */
 /* Command or response */
 #define PS2_KEY_RESEND   0xFE
@@ -377,6 +409,33 @@ class PS2KeyAdvanced {
        If there is no key available, 0 is returned.  */
     uint16_t read( );
 
+    /* Returns the next code received from the keyboard without any
+       translation, i.e. the set 2 scan code in the low byte, and PS2_RAW_
+       status bits for the prefixes seen in the high byte. Lock keys are
+       not handled. If there is no code available, 0 is returned.
+       Do not mix with available( ) and read( ). */
+    uint16_t readRaw( );
+
+    /* Sets a function that gets each complete code from the keyboard right
+       in the interrupt handler, in the same format as returned by readRaw( ),
+       as long as no codes are waiting in the buffer. If it returns true, the
+       code is considered handled and not buffered. NULL removes it.
+       Keep it short, as it runs with interrupts disabled. */
+    void setRawHandler( bool ( *handler )( uint16_t ) );
+
+    /* Returns whether codes got lost since last call, because the receive
+       buffer was full, or the keyboard reported an overrun. */
+    bool lost( );
+
+    /* Copies the receive error counters into stats, see PS2Stats */
+    void getStats( PS2Stats *stats );
+
+    /* Sets the receive error counters to zero */
+    void resetStats( );
+
+    /* Returns the time stamp of the key last read, see latency.h */
+    uint16_t lastStamp( );
+
     /* Returns the current status of Locks
         Use Macro to mask out bits from
         PS2_LOCK_NUM    PS2_LOCK_CAPS   PS2_LOCK_SCROLL */
@@ -384,8 +443,14 @@ class PS2KeyAdvanced {
 
     /* Sets the current status of Locks and LEDs
        Use macro defines added together from
-        PS2_LOCK_NUM    PS2_LOCK_CAPS   PS2_LOCK_SCROLL */
-    void setLock( byte );
+        PS2_LOCK_NUM    PS2_LOCK_CAPS   PS2_LOCK_SCROLL
+       LED update is queued, a queued one not yet started is updated instead
+       Commands below are queued likewise, sent from interrupt handler and
+       driven by available( ) or readRaw( ), so they never block. Optional
+       callback gets the result, see PS2Callback
+       Error returns 0 OK
+                   -4 command queue full */
+    int setLock( byte, PS2Callback = NULL );
 
     /* Set library to not send break key codes
             1 = no break codes
@@ -400,19 +465,19 @@ class PS2KeyAdvanced {
     /* Resets keyboard when reset has completed
        keyboard sends AA - Pass or FC for fail
        Read from keyboard data buffer */
-    void resetKey( );
+    int resetKey( PS2Callback = NULL );
 
     /*  Get the current Scancode Set used in keyboard
         returned data in keyboard buffer read as keys */
-    void getScanCodeSet( void );
+    int getScanCodeSet( PS2Callback = NULL );
 
     /*  Get the current Scancode Set used in keyboard
         returned data in keyboard buffer read as keys */
-    void readID( void );
+    int readID( PS2Callback = NULL );
 
     /*  Send Echo command to keyboard
-        returned data in keyboard buffer read as keys */
-    void echo( void );
+        callback gets PS2_CMD_OK when keyboard echoed */
+    int echo( PS2Callback = NULL );
 
     /*  Send Typematic rate/delay command to keyboard
        First Parameter  rate is 0 - 0x1F (31)
@@ -421,7 +486,9 @@ class PS2KeyAdvanced {
                 default in keyboard is 0xB (10.9 CPS)
        Second Parameter delay is 0 - 3 for 0.25s to 1s in 0.25 increments
          default in keyboard is 1 = 0.5 second delay
-        Returned data in keyboard buffer read as keys */
-    int typematic( uint8_t , uint8_t );
+       Error returns 0 OK
+                    -4 command queue full
+                    -5 parameter error */
+    int typematic( uint8_t , uint8_t, PS2Callback = NULL );
 };
 #endif
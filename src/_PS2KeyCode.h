@@ -51,13 +51,32 @@
 /* Ignore code for key code translation */
 #define PS2_KEY_IGNORE  0xBB
 
-//  buffer sizes keyboard RX and TX, then key reading buffer
+//  buffer sizes keyboard RX, TX command queue, then key reading buffer
+// RX and key buffers can be set by defining PS2_RX_BUFFER_SIZE and
+// PS2_KEY_BUFFER_SIZE, powers of two for mask arithmetic
+#ifndef PS2_RX_BUFFER_SIZE
+#define PS2_RX_BUFFER_SIZE   16
+#endif
+#ifndef PS2_KEY_BUFFER_SIZE
+#define PS2_KEY_BUFFER_SIZE  8
+#endif
 // Minimum size 8 can be larger
-#define _RX_BUFFER_SIZE  8
-// Minimum size 6 can be larger
-#define _TX_BUFFER_SIZE  6
+#define _RX_BUFFER_SIZE  PS2_RX_BUFFER_SIZE
+#define _RX_MASK         ( _RX_BUFFER_SIZE - 1 )
+// Commands queued for keyboard, one less than size. Power of two, minimum 2
+#define _CMD_QUEUE_SIZE  4
+#define _CMD_MASK        ( _CMD_QUEUE_SIZE - 1 )
 // Output Buffer of unsigned int values. Minimum size 4 can be larger
-#define _KEY_BUFF_SIZE   4
+#define _KEY_BUFF_SIZE   PS2_KEY_BUFFER_SIZE
+#define _KEY_MASK        ( _KEY_BUFF_SIZE - 1 )
+
+#if ( _RX_BUFFER_SIZE & _RX_MASK ) != 0 || _RX_BUFFER_SIZE < 8
+#error "PS2_RX_BUFFER_SIZE must be a power of two, and at least 8"
+#endif
+
+#if ( _KEY_BUFF_SIZE & _KEY_MASK ) != 0 || _KEY_BUFF_SIZE < 4
+#error "PS2_KEY_BUFFER_SIZE must be a power of two, and at least 4"
+#endif
 
 /* private defines for library files not global */
 /* _ps2mode status flags */
@@ -69,9 +88,18 @@
 #define _E1_MODE         0x04
 #define _LAST_VALID      0x02
 
-/* _tx_ready flags */
-#define _HANDSHAKE       0x80
-#define _COMMAND         0x01
+/* _cmd_state values for command at head of queue */
+#define _CMD_IDLE        0    // not started yet
+#define _CMD_WAIT_ACK    1    // byte sent, waiting for ACK
+#define _CMD_WAIT_DATA   2    // all bytes sent, waiting for response bytes
+#define _CMD_DONE        3    // finished, result in _cmd_result
+
+/* Command timeouts in ms, per byte sent plus one for waiting for idle line,
+   and for response bytes e.g. BAT after reset */
+#define _CMD_BYTE_TIMEOUT      25
+#define _CMD_RESPONSE_TIMEOUT  1000
+/* Resend requests from keyboard for one byte before command fails */
+#define _CMD_RETRIES     3
 
 /* Key Repeat defines */
 #define _NO_BREAKS       0x08
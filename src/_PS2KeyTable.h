@@ -56,19 +56,20 @@
 #ifndef PS2KeyTable_h
 #define PS2KeyTable_h
 
+#include "pgmtable.h"
+
 /* Table contents are pairs of numbers
     first code from keyboard
     second is either PS2_KEY_IGNOPRE code or key code to return
 
+   These pair tables are only evaluated at compile time, for generating the
+   direct indexed decode tables below, so they do not end up in the image.
+
    Single byte Key table
     In codes can only be 1 - 0x9F, plus 0xF2 and 0xF1
     Out Codes in range 1 to 0x9F
 */
-#if defined(PS2_REQUIRES_PROGMEM)
-const uint8_t PROGMEM single_key[][ 2 ] = {
-#else
-const uint8_t single_key[][ 2 ] = {
-#endif
+constexpr uint8_t single_key[][ 2 ] = {
                 { PS2_KC_NUM, PS2_KEY_NUM },
                 { PS2_KC_SCROLL, PS2_KEY_SCROLL },
                 { PS2_KC_CAPS, PS2_KEY_CAPS },
@@ -182,12 +183,9 @@ const uint8_t single_key[][ 2 ] = {
                 { PS2_KC_LANG5, PS2_KEY_LANG5 }
                 };
 
-/* Two byte Key  table after an E0 byte received */
-#if defined(PS2_REQUIRES_PROGMEM)
-const uint8_t PROGMEM extended_key[][ 2 ] = {
-#else
-const uint8_t extended_key[][ 2 ] = {
-#endif
+/* Two byte Key  table after an E0 byte received
+    In codes can only be 1 - 0x7F */
+constexpr uint8_t extended_key[][ 2 ] = {
                 { PS2_KC_IGNORE, PS2_KEY_IGNORE },
                 { PS2_KC_PRTSCR, PS2_KEY_PRTSCR },
                 { PS2_KC_CTRL, PS2_KEY_R_CTRL },
@@ -231,6 +229,44 @@ const uint8_t extended_key[][ 2 ] = {
                 { PS2_KC_WAKE, PS2_KEY_WAKE }
                 };
 
+/* Number of pairs in pair table */
+template<uint8_t N>
+constexpr uint8_t pair_count( const uint8_t ( & )[ N ][ 2 ] )
+{
+return N;
+}
+
+/* Returns key code for scan code from pair table, 0 if not found.
+   First match wins, the same as a linear scan at run time would. */
+constexpr uint8_t scan_lookup( const uint8_t table[][ 2 ], uint8_t length,
+                               uint8_t code, uint8_t index = 0 )
+{
+return index >= length ? 0
+       : table[ index ][ 0 ] == code ? table[ index ][ 1 ]
+       : scan_lookup( table, length, code, index + 1 );
+}
+
+struct SingleKeyDecode {
+  static constexpr uint8_t at( uint8_t code )
+    {
+    return scan_lookup( single_key, pair_count( single_key ), code );
+    }
+};
+
+struct ExtendedKeyDecode {
+  static constexpr uint8_t at( uint8_t code )
+    {
+    return scan_lookup( extended_key, pair_count( extended_key ), code );
+    }
+};
+
+/* Direct indexed decode tables in flash, one plane for single byte codes
+   and one for codes after E0, each indexed by the set 2 scan code. An entry
+   of 0 means not a key. The E0 plane only covers codes up to 0x7F, reading
+   past that gives 0 as well. */
+typedef PgmTable<SingleKeyDecode, 256, 0> single_key_plane;
+typedef PgmTable<ExtendedKeyDecode, 128, 0> extended_key_plane;
+
 /* Scroll lock numeric keypad re-mappings for NOT NUMLOCK */
 /* in translated code order order is important */
 #if defined(PS2_REQUIRES_PROGMEM)
@@ -17,11 +17,48 @@
 #ifndef SPECTRATUR_h
 #define SPECTRATUR_h
 
-// Set whether to activate debug mode. In debug mode, diagnostic messages are
-// written to the serial port.
+// Set whether to activate debug mode. In debug mode, trace records are
+// written to the serial port, see trace.h. kev shows them with `-v debug`.
 //
 #define DEBUG false
 
+// Number of trace records buffered in debug mode, must be a power of two.
+// Each record takes 9 bytes of RAM.
+//
+#define TRACE_BUFFER_SIZE 16
+
+
+// Default baud rate of the serial link to the host. The host can switch to
+// a higher rate, see serialproto.h.
+//
+#define SERIAL_BAUD 115200
+
+// Time in milliseconds within which the host needs to confirm a switch to a
+// different baud rate by sending a valid frame. Otherwise, the serial link is
+// reverted to defaults.
+//
+#define SERIAL_BAUD_CONFIRM_TIMEOUT 1000
+
+// Sizes in bytes of the serial receive and transmit buffers. Both need to be
+// a power of two, and no larger than 256. The receive buffer should be large
+// enough for holding a burst of key events from the host.
+//
+#define UART_RX_BUFFER_SIZE 128
+#define UART_TX_BUFFER_SIZE 64
+
+// Credits for flow control (serial protocol version 2) are granted to the
+// host once this many bytes have been processed, or at the latest after this
+// many milliseconds.
+//
+#define SERIAL_CREDIT_BATCH 16
+#define SERIAL_CREDIT_INTERVAL 5
+
+// Time in milliseconds after which an incomplete frame received from the host
+// is discarded. The host always sends complete frames, so this happens only
+// when a byte got lost.
+//
+#define SERIAL_FRAME_TIMEOUT 20
+
 
 // Set whether to use an external keyboard (PS/2 or PS/2 capable USB keyboard).
 //
@@ -34,11 +71,66 @@
 //
 #define EXTERNAL_KBD_RESET_TIMEOUT 3000
 
+// Number of entries in the buffers for codes received from the external
+// keyboard, and for keys translated by the PS/2 library (not used in raw mode).
+// Each entry takes 4 bytes of RAM. Both need to be a power of two, at least 8
+// and 4 respectively, and no larger than 128. If codes get lost because the
+// receive buffer is full, all keys held down via the external keyboard are
+// released, so that no key stays pressed on the target.
+//
+#define EXTERNAL_KBD_RX_BUFFER_SIZE 16
+#define EXTERNAL_KBD_KEY_BUFFER_SIZE 8
+
+// Set whether to handle the external keyboard in raw mode. Scan codes are then
+// mapped directly to target keys, bypassing the translation done by the PS/2
+// library, which roughly halves the work per key stroke. Lock keys act like
+// plain keys in raw mode, i.e. they're passed on when pressed and released,
+// and only their LEDs get toggled in the background. Keypad keys are always
+// passed on as such, regardless of NUM lock. Builds that cover both modes,
+// such as the host checks in sim/test, can set this on the command line.
+//
+#ifndef EXTERNAL_KBD_RAW
+#define EXTERNAL_KBD_RAW false
+#endif
 
-// Set whether to use a joystick port.
+// Set whether plain keys from the external keyboard are applied to the MT88xx
+// right in the PS/2 interrupt, instead of waiting for the main loop. Key events
+// are still passed to the main loop if it is busy with the target keyboard,
+// or has PS/2 events pending, so their order is kept. Combos, macros, lock
+// keys, and replies from the keyboard always go through the main loop. Needs
+// raw mode. Can be set on the command line, like EXTERNAL_KBD_RAW.
+//
+#ifndef EXTERNAL_KBD_FAST_LANE
+#define EXTERNAL_KBD_FAST_LANE false
+#endif
+
+
+// Set whether to use a joystick port. Joystick contacts are debounced: a
+// change is only passed on once it has been stable for four scheduler ticks,
+// i.e. 2ms with the default tick length.
 //
 #define JOYSTICK true
 
+// Length in microseconds of a scheduler tick. All input sources are polled
+// once per tick, so this bounds the time an input event waits before it gets
+// processed. Must be a multiple of 4 between 4 and 1024.
+//
+#define SCHEDULER_TICK_US 500
+
+// Maximum number of tasks the scheduler can run
+//
+#define SCHEDULER_MAX_TASKS 6
+
+// Interval in ticks for reporting scheduler statistics in debug mode
+//
+#define SCHEDULER_REPORT_TICKS 10000
+
+// Set whether to record the latency from key events entering the adapter to
+// the according MT88xx switch changes. The host can query the histograms via
+// the serial link, see serialproto.h.
+//
+#define LATENCY_STATS true
+
 // Choose which chip you're using. Depending on chip, different key addresses
 // need to be used. Targets can switch the set of key addresses based on this
 // setting.
@@ -66,28 +158,44 @@ static const uint8_t K_MASK_AY = B01110000; // mask for AY address bits
 //
 #define MACRO_DELAY_RELEASE 200
 
+// Maximum number of macros that can be queued for playback. Macros are played
+// back step by step from the main loop, so input from other sources is still
+// processed while a macro is running. Macros triggered while the queue is
+// full are dropped.
+//
+#define MACRO_QUEUE_SIZE 4
+
 
 // Include the header file with all the necessary definitions for your target
-// system here.
+// system here. Builds that cover several targets, such as the benchmark, can
+// instead set SPECTRATUR_TARGET to the name of the header, without extension,
+// e.g. -DSPECTRATUR_TARGET=sinclair_spectrum
 //
+#ifdef SPECTRATUR_TARGET
+#define SPECTRATUR_STR(x) #x
+#define SPECTRATUR_XSTR(x) SPECTRATUR_STR(x)
+#include SPECTRATUR_XSTR(targets/SPECTRATUR_TARGET.h)
+#else
 //#include "targets/sinclair_spectrum.h"
 //#include "targets/sinclair_zx80.h"
 #include "targets/sinclair_zx81.h"
+#endif
 
 
 // --- debug helpers ----------------------------------------------------------
 
+// Trace point, e.g. TRACE(TRGT_KEY, k, a, refs), for an event defined in
+// trace_events.h, with up to three arguments of up to 16 bits.
+//
 #if DEBUG == true
 
-#include <Arduino.h>
+#include "trace.h"
 
-#define DPRINT(...)    Serial.print(__VA_ARGS__)
-#define DPRINTLN(...)  Serial.println(__VA_ARGS__)
+#define TRACE(event, ...)  trace.record(TRACE_##event, ##__VA_ARGS__)
 
 #else
 
-#define DPRINT(...)
-#define DPRINTLN(...)
+#define TRACE(event, ...)
 
 #endif
 
@@ -14,127 +14,399 @@
     limitations under the License.
 */
 
+#include <util/atomic.h>
+
 #include "externalkbd.h"
+#include "latency.h"
+
+#include "_PS2KeyCode.h"
+#include "_PS2KeyTable.h"
+
+/*
+    Generators for the tables used in raw mode, translating set 2 scan codes
+    directly to target key addresses, one for single byte codes and one for
+    codes following an E0 prefix. They chain the decode tables of the PS/2
+    library with `Ps2ToTarget`, all at compile time.
+ */
+struct ScanToTarget {
+    static constexpr uint8_t at(uint8_t scanCode) {
+        return Ps2ToTarget::at(SingleKeyDecode::at(scanCode));
+    }
+};
+
+struct ScanE0ToTarget {
+    static constexpr uint8_t at(uint8_t scanCode) {
+        return Ps2ToTarget::at(ExtendedKeyDecode::at(scanCode));
+    }
+};
+
+typedef PgmTable<ScanToTarget, 256> MapScanToTarget;
+typedef PgmTable<ScanE0ToTarget, 128> MapScanE0ToTarget;
+
+ExternalKbd *ExternalKbd::fastLaneKbd = NULL;
 
 //
-ExternalKbd::ExternalKbd(uint8_t dataPin, uint8_t irqPin) :
-    map{MAP_INPUT_TO_TARGET, array_len(MAP_INPUT_TO_TARGET)} {
+ExternalKbd::ExternalKbd(uint8_t dataPin, uint8_t irqPin) {
     ps2.begin(dataPin, irqPin);
 }
 
-//
+// Resets the keyboard. This only sends the reset command, the reply is
+// handled by process(). If there's no reply within the timeout, the keyboard
+// is considered not being attached. It can still be attached later on, in
+// which case it will announce itself by sending a BAT.
 void ExternalKbd::reset() {
+    TRACE(PS2_RESET);
+    resetStart = millis();
+    state = KBD_RESETTING;
+    heldLocks = 0;
+    memset(heldKeys, 0, sizeof(heldKeys));
+    ps2.resetKey(commandDone);
+}
+
+//
+void ExternalKbd::config() {
+    ps2.setLock(PS2_LOCK_NUM, commandDone);
+    ps2.setNoRepeat(1);
+}
 
-    DPRINT("[PS/2] resetting ... ");
-
-    unsigned long start = millis();
-    ps2.resetKey();
-
-    while ((millis() - start) < EXTERNAL_KBD_RESET_TIMEOUT) {
-        if (ps2.available()) {
-            switch (ps2.read()) {
-                case 0xaa:
-                    DPRINTLN("OK");
-                    ps2.setLock(PS2_LOCK_NUM);
-                    ps2.setNoRepeat(1);
-                    return;
-                case 0xfc:
-                    DPRINTLN("NG");
-                    return;
+// Called by the PS/2 library when a command sent to the keyboard has
+// completed. A failed reset shows up as not attached via the reset timeout,
+// and a failed LED update is corrected by the next one, so this only traces.
+// Without DEBUG, TRACE expands to nothing, and command goes unused.
+void ExternalKbd::commandDone(uint8_t command, uint8_t result) {
+    (void)command;
+    if (result != PS2_CMD_OK) {
+        TRACE(PS2_CMD_FAILED, command, result);
+    }
+}
+
+// Handles replies from the keyboard, i.e. codes that are not key codes.
+// Returns true if the code was a reply.
+bool ExternalKbd::handleReply(uint8_t reply) {
+
+    switch (reply) {
+
+        case PS2_REPLY_BAT:
+            if (state == KBD_RESETTING) {
+                TRACE(PS2_RESET_OK);
+            } else {
+                TRACE(PS2_ATTACHED);
             }
-        }
-        delay(250);
+            state = KBD_READY;
+            config();
+            return true;
+
+        case PS2_REPLY_ERROR:
+            if (state == KBD_RESETTING) {
+                TRACE(PS2_RESET_NG);
+                state = KBD_READY;
+            }
+            return true;
     }
 
-    DPRINTLN("not attached");
+    // any other replies, e.g. ACK, are handled by the PS/2 library
+    return reply >= PS2_REPLY_BAT;
 }
 
 //
 void ExternalKbd::process(TargetKbd *kbd, Joystick *joy) {
 
+    if (state == KBD_RESETTING
+        && (millis() - resetStart) >= EXTERNAL_KBD_RESET_TIMEOUT) {
+        TRACE(PS2_NOT_ATTACHED);
+        state = KBD_READY;
+    }
+
+    if (EXTERNAL_KBD_RAW) {
+        processRaw(kbd, joy);
+    } else {
+        processTranslated(kbd, joy);
+    }
+}
+
+// Handles the next key as translated by the PS/2 library.
+void ExternalKbd::processTranslated(TargetKbd *kbd, Joystick *joy) {
+
     if (!ps2.available()) {
+        if (ps2.lost()) {
+            releaseHeld(kbd);
+        }
         return;
     }
 
     uint16_t c = ps2.read();
 
-    if (c == 0) {
+    if (c == 0 || (c <= 0xff && handleReply(c))) {
         return;
     }
 
     uint8_t code = c & 0xff;
+    bool release = (c & PS2_BREAK) != 0;
 
-    // special cases
-    // TODO make configurable
-    if ((c & PS2_BREAK) != 0) {
+    if (state == KBD_MAPPING_JOYSTICK) {
+        collectJoystickMap(MapPs2ToTarget::read(code), release, joy);
+        return;
+    }
+
+    if (release && handleCommand(code, kbd, joy)) {
+        return;
+    }
+
+    uint8_t key = MapPs2ToTarget::read(code);
+
+    TRACE(PS2_KEY, c, key);
+
+    latency.arm(LATENCY_PS2, ps2.lastStamp());
+    applyKey(kbd, key, release);
+    latency.disarm();
+}
+
+// Handles the next raw scan code from the keyboard. While doing so, the fast
+// lane is held off, since it could otherwise overtake this code.
+void ExternalKbd::processRaw(TargetKbd *kbd, Joystick *joy) {
+
+    setRawPending(true);
+
+    uint16_t c = ps2.readRaw();
+
+    if (c != 0) {
+        handleRaw(c, kbd, joy);
+    } else if (ps2.lost()) {
+        releaseHeld(kbd);
+    }
+
+    setRawPending(false);
+}
+
+// Handles a raw scan code. PAUSE is the only key sending an E1 sequence,
+// which the PS/2 library collapses into one code. Like in translated mode, it
+// never gets released.
+void ExternalKbd::handleRaw(uint16_t c, TargetKbd *kbd, Joystick *joy) {
+
+    uint8_t code = c & 0xff;
+
+    // anything that's not a key code, see translate() in the PS/2 library
+    if ((c & PS2_RAW_RESPONSE) != 0 || (code >= PS2_REPLY_BAT
+        && code != PS2_KC_LANG1 && code != PS2_KC_LANG2)) {
+        handleReply(code);
+        return;
+    }
+
+    bool release = (c & PS2_RAW_BREAK) != 0;
+    uint8_t command = 0;
+    uint8_t key;
+
+    if ((c & PS2_RAW_E1) != 0) {
+        key = MapPs2ToTarget::read(PS2_KEY_PAUSE);
+    } else if ((c & PS2_RAW_E0) != 0) {
+        key = MapScanE0ToTarget::read(code);
+    } else {
+        key = MapScanToTarget::read(code);
         switch (code) {
-            case 27: // reset
-                reset();
-                if (kbd != NULL) {
-                    kbd->reset();
-                }
-                if (joy != NULL) {
-                    joy->reset();
-                }
-                return;
-            case 97: // joystick setup
-                setJoystickMap(joy);
-                return;
+            case PS2_KC_CAPS:
+                handleLock(PS2_LOCK_CAPS, release);
+                break;
+            case PS2_KC_NUM:
+                handleLock(PS2_LOCK_NUM, release);
+                break;
+            case PS2_KC_SCROLL:
+                handleLock(PS2_LOCK_SCROLL, release);
+                break;
+            case PS2_KC_ESC:
+                command = PS2_KEY_ESC;
+                break;
+            case PS2_KC_F1:
+                command = PS2_KEY_F1;
+                break;
         }
     }
 
-    code = toInputCode(code);
-    uint8_t key = map.translate(code);
-    KeyAction a;
+    if (state == KBD_MAPPING_JOYSTICK) {
+        collectJoystickMap(key, release, joy);
+        return;
+    }
 
-    if ((c & PS2_BREAK) != 0) {
-        a = RELEASE_KEY;
-    } else {
-        a = PRESS_KEY;
+    if (release && handleCommand(command, kbd, joy)) {
+        return;
+    }
+
+    TRACE(PS2_KEY, c, key);
+
+    latency.arm(LATENCY_PS2, ps2.lastStamp());
+    applyKey(kbd, key, release);
+    latency.disarm();
+}
+
+// Passes a key on to the target keyboard, keeping track of the keys held down
+// via the external keyboard.
+void ExternalKbd::applyKey(TargetKbd *kbd, uint8_t key, bool release) {
+    if (key != NA) {
+        setHeld(key, !release);
     }
+    kbd->handleKey(key, release ? RELEASE_KEY : PRESS_KEY);
+}
+
+// Releases all keys held down via the external keyboard. This is done when
+// codes from the keyboard got lost, once all codes received before have been
+// handled. A lost code may have been a break, which would otherwise leave its
+// key pressed on the target.
+void ExternalKbd::releaseHeld(TargetKbd *kbd) {
 
-    DPRINTLN("[PS/2] control: " + String(c >> 8) + ", action: " + String(a) +
-        ", code: " + String(code) + ", key: " + String(key));
+    TRACE(PS2_RELEASE_HELD);
 
-    kbd->handleKey(key, a);
+    for (uint8_t ix = 0; ix < array_len(heldKeys); ix++) {
+        for (uint8_t bit = 0; heldKeys[ix] != 0; bit++) {
+            if (heldKeys[ix] & (1 << bit)) {
+                heldKeys[ix] &= ~(1 << bit);
+                kbd->handleKey((ix << 3) | bit, RELEASE_KEY);
+            }
+        }
+    }
 }
 
 //
-uint8_t ExternalKbd::toInputCode(uint8_t ps2Code) {
-    if (ps2Code < array_len(MAP_PS2_TO_INPUT)) {
-        return MAP_PS2_TO_INPUT[ps2Code];
+void ExternalKbd::setHeld(uint8_t key, bool held) {
+    if (held) {
+        heldKeys[key >> 3] |= 1 << (key & 7);
+    } else {
+        heldKeys[key >> 3] &= ~(1 << (key & 7));
     }
-    return KEY_RESERVED;
 }
 
 //
-void ExternalKbd::setJoystickMap(Joystick *j) {
+void ExternalKbd::getStats(PS2Stats *s) {
+    ps2.getStats(s);
+}
 
-    if (j == NULL) {
-        return;
+//
+void ExternalKbd::resetStats() {
+    ps2.resetStats();
+}
+
+// Sets whether a raw code is being handled by the main loop. The atomic block
+// keeps the compiler from moving reading the code ahead of this.
+void ExternalKbd::setRawPending(bool pending) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rawPending = pending;
     }
+}
 
-    DPRINTLN("[PS/2] setting joystick map");
-    uint8_t m[JOYSTICK_ACTIONS];
+// Enables the fast lane, which applies plain keys to the target keyboard
+// right from the PS/2 interrupt. Only works in raw mode, and there can only
+// be a single external keyboard using it.
+void ExternalKbd::enableFastLane(TargetKbd *kbd) {
+    if (EXTERNAL_KBD_RAW) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            fastLaneTarget = kbd;
+            fastLaneKbd = this;
+            ps2.setRawHandler(fastLane);
+        }
+    }
+}
 
-    for (int ix = 0; ix < JOYSTICK_ACTIONS; ) {
+// Called by the PS/2 library from its ISR with each complete code, while none
+// are buffered. Returns true if the code was handled here. Everything that is
+// not a plain key, and keys arriving while the main loop is dealing with a PS/2
+// code, an armed latency measurement, or the target keyboard, are left to the
+// main loop.
+bool ExternalKbd::fastLane(uint16_t c) {
 
-        if (ps2.available()) {
+    ExternalKbd *ext = fastLaneKbd;
+    uint8_t code = c & 0xff;
 
-            uint16_t c = ps2.read();
+    if (ext->state != KBD_READY || ext->rawPending || latency.isArmed()
+        || (c & (PS2_RAW_RESPONSE | PS2_RAW_E1)) != 0
+        || code >= PS2_REPLY_BAT) {
+        return false;
+    }
 
-            if ((c & PS2_BREAK) != 0) {
-                uint8_t code = toInputCode(c & 0xff);
-                uint8_t key = map.translate(code);
-                DPRINTLN("[PS/2] joystick setup " + String(key));
-                m[ix] = key;
-                ix++;
-            }
+    uint8_t key;
 
-        } else {
-            delay(100);
+    if ((c & PS2_RAW_E0) != 0) {
+        key = MapScanE0ToTarget::read(code);
+    } else {
+        switch (code) {
+            case PS2_KC_CAPS:
+            case PS2_KC_NUM:
+            case PS2_KC_SCROLL:
+            case PS2_KC_ESC:
+            case PS2_KC_F1:
+                return false;
         }
+        key = MapScanToTarget::read(code);
+    }
+
+    KeyAction a = (c & PS2_RAW_BREAK) != 0 ? RELEASE_KEY : PRESS_KEY;
+
+    latency.arm(LATENCY_PS2, Latency::now());
+    bool handled = ext->fastLaneTarget->tryHandleKey(key, a);
+    latency.disarm();
+
+    if (handled) {
+        ext->setHeld(key, a == PRESS_KEY);
+        TRACE(PS2_FAST_KEY, c, key);
+    }
+
+    return handled;
+}
+
+// Handles keys with a special meaning for the adapter, given as codes of the
+// PS/2 library, on their release. Returns true if the key was one of them.
+bool ExternalKbd::handleCommand(uint8_t ps2Code, TargetKbd *kbd,
+    Joystick *joy) {
+
+    // TODO make configurable
+    switch (ps2Code) {
+        case PS2_KEY_ESC: // reset
+            reset();
+            if (kbd != NULL) {
+                kbd->reset();
+            }
+            if (joy != NULL) {
+                joy->reset();
+            }
+            return true;
+        case PS2_KEY_F1: // joystick setup
+            if (joy != NULL) {
+                TRACE(PS2_JOY_MAP_START);
+                joystickMapIx = 0;
+                state = KBD_MAPPING_JOYSTICK;
+            }
+            return true;
     }
 
-    j->setMap(m);
+    return false;
+}
+
+// Toggles the LED of a lock key in raw mode, when the key gets pressed. Makes
+// repeated while the key is held down are ignored. The PS/2 library queues
+// the LED command, and sends it to the keyboard in the background.
+void ExternalKbd::handleLock(uint8_t lock, bool release) {
+
+    if (release) {
+        heldLocks &= ~lock;
+    } else if ((heldLocks & lock) == 0) {
+        heldLocks |= lock;
+        ps2.setLock(ps2.getLock() ^ lock, commandDone);
+    }
+}
+
+// Collects the keys for the joystick map, one key per call, on its release.
+// Once all keys have been collected, the map is passed on to the joystick.
+void ExternalKbd::collectJoystickMap(uint8_t key, bool release,
+    Joystick *joy) {
+
+    if (!release) {
+        return;
+    }
+
+    TRACE(PS2_JOY_MAP, key);
+    joystickMap[joystickMapIx++] = key;
+
+    if (joystickMapIx == array_len(joystickMap)) {
+        state = KBD_READY;
+        if (joy != NULL) {
+            joy->setMap(joystickMap);
+        }
+    }
 }
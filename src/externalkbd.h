@@ -23,7 +23,7 @@
 
 #include "config.h"
 #include "joystick.h"
-#include "keymap.h"
+#include "pgmtable.h"
 #include "targetkbd.h"
 #include "input_keycodes.h"
 
@@ -31,10 +31,10 @@
     translation table for translating codes returned by PS2KeyAdvanced library
     to our input key codes. It's somewhat redundant, since the library already
     does a translation, but it does not seem trivial to modify its translation
-    table without hurting functionality. But it's a small table and only a
-    single array lookup, so not much of an overhead.
+    table without hurting functionality. This table is only used at compile
+    time though, for generating `MapPs2ToTarget` below, so it costs nothing.
  */
-static const uint8_t MAP_PS2_TO_INPUT[] = {
+static constexpr uint8_t MAP_PS2_TO_INPUT[] PROGMEM = {
     KEY_RESERVED,
     KEY_NUMLOCK,    // PS2_KEY_NUM         0x01
     KEY_SCROLLLOCK, // PS2_KEY_SCROLL      0x02
@@ -146,21 +146,76 @@ static const uint8_t MAP_PS2_TO_INPUT[] = {
     KEY_F12         // PS2_KEY_F12         0X6C
 };
 
+/*
+    Generator for the table translating codes returned by PS2KeyAdvanced
+    directly to target key addresses, by composing `MAP_PS2_TO_INPUT` with
+    the target's `MAP_INPUT_TO_TARGET`. The external keyboard then needs only
+    a single lookup per key event.
+ */
+struct Ps2ToTarget {
+    static constexpr uint8_t at(uint8_t ps2Code) {
+        return ps2Code < array_len(MAP_PS2_TO_INPUT)
+            && MAP_PS2_TO_INPUT[ps2Code] < array_len(MAP_INPUT_TO_TARGET)
+            ? MAP_INPUT_TO_TARGET[MAP_PS2_TO_INPUT[ps2Code]] : NA;
+    }
+};
+
+typedef PgmTable<Ps2ToTarget, array_len(MAP_PS2_TO_INPUT)> MapPs2ToTarget;
+
+// replies from keyboard
+static const uint8_t PS2_REPLY_BAT   = 0xaa; // basic assurance test passed
+static const uint8_t PS2_REPLY_ERROR = 0xfc;
+
+// states of the external keyboard
+enum ExternalKbdState {
+    KBD_READY,              // regular key handling
+    KBD_RESETTING,          // waiting for reply to reset
+    KBD_MAPPING_JOYSTICK    // collecting keys for joystick map
+};
+
 //
 class ExternalKbd {
 
 private:
     PS2KeyAdvanced ps2;
-    KeyMap map;
+    ExternalKbdState state = KBD_READY;
+    unsigned long resetStart = 0;
+    uint8_t joystickMap[JOYSTICK_ACTIONS];
+    uint8_t joystickMapIx = 0;
+    uint8_t heldLocks = 0;  // lock keys currently held down, in raw mode
+    // Bit set of keys held down via the external keyboard, by target key,
+    // for releasing them when codes from the keyboard got lost. In raw mode,
+    // only changed while rawPending is set, or from the fast lane.
+    uint8_t heldKeys[32];
+
+    // target for the fast lane, and whether a raw code has been taken from
+    // the PS/2 library, but not yet handled by the main loop
+    TargetKbd *fastLaneTarget = NULL;
+    volatile bool rawPending = false;
+    static ExternalKbd *fastLaneKbd;
 
     void config();
-    uint8_t toInputCode(uint8_t ps2Code);
-    void setJoystickMap(Joystick *joy);
+    bool handleReply(uint8_t reply);
+    bool handleCommand(uint8_t ps2Code, TargetKbd *kbd, Joystick *joy);
+    void handleLock(uint8_t lock, bool release);
+    void processTranslated(TargetKbd *kbd, Joystick *joy);
+    void processRaw(TargetKbd *kbd, Joystick *joy);
+    void handleRaw(uint16_t c, TargetKbd *kbd, Joystick *joy);
+    void setRawPending(bool pending);
+    static bool fastLane(uint16_t c);
+    static void commandDone(uint8_t command, uint8_t result);
+    void collectJoystickMap(uint8_t key, bool release, Joystick *joy);
+    void applyKey(TargetKbd *kbd, uint8_t key, bool release);
+    void releaseHeld(TargetKbd *kbd);
+    void setHeld(uint8_t key, bool held);
 
 public:
     ExternalKbd(uint8_t dataPin, uint8_t irqPin);
     void reset();
     void process(TargetKbd *kbd, Joystick *joy);
+    void enableFastLane(TargetKbd *kbd);
+    void getStats(PS2Stats *s);
+    void resetStats();
 };
 
 #endif
@@ -14,48 +14,102 @@
     limitations under the License.
 */
 
+#include <util/atomic.h>
+
 #include "joystick.h"
+#include "latency.h"
 
-//
-Joystick::Joystick() {}
+// Set by the pin change interrupt on any edge of the joystick pins, and
+// cleared by process() once the port has settled. The stamp is the time of
+// the first edge after the port was last settled.
+static volatile bool pending = false;
+static volatile uint16_t edgeStamp = 0;
 
 //
+ISR(PCINT1_vect) {
+    if (!pending) {
+        edgeStamp = Latency::now();
+        pending = true;
+    }
+}
+
+// Enables the pin change interrupt for the joystick pins.
+Joystick::Joystick() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PCMSK1 |= JOYSTICK_ALL;
+        PCIFR = (1 << PCIF1);
+        PCICR |= (1 << PCIE1);
+    }
+}
+
+// Resets the debounced state to all released. A pin that's held gets picked
+// up again on the next call to process().
 void Joystick::reset() {
-    DPRINTLN("[ JOY] resetting");
-    setMap(DEFAULT_MAP);
+    TRACE(JOY_RESET);
+    uint8_t m[JOYSTICK_ACTIONS];
+    memcpy_P(m, DEFAULT_MAP, sizeof(m));
+    setMap(m);
     state = JOYSTICK_ALL;
+    count0 = 0;
+    count1 = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        edgeStamp = Latency::now();
+        pending = true;
+    }
 }
 
-//
-void Joystick::process(uint8_t data, TargetKbd *kbd) {
-
-    data = data & JOYSTICK_ALL;
-    uint8_t diff = data ^ state;
+// Debounces all pins at once, with a vertical counter per pin that advances
+// once per call, i.e. per scheduler tick. A change is passed on once the pin
+// has been in its new state for four ticks in a row, so contact bounce never
+// reaches the target keyboard. Returns right away while there's no edge.
+void Joystick::process(TargetKbd *kbd) {
 
-    if (diff == 0) {
+    if (!pending) {
         return;
     }
 
-    DPRINTLN("[ JOY] port data: " + String(data));
+    uint8_t data = PINC & JOYSTICK_ALL;
+    uint8_t delta = data ^ state;
 
-    uint8_t mask = 1;
+    // counters of pins that are back in their debounced state restart at 0
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+    uint8_t changes = delta & ~(count0 | count1);
 
-    for (uint8_t ix = 0; ix < JOYSTICK_ACTIONS; ix++) {
-        if ((diff & mask) != 0) {
-            kbd->handleKey(
-                map[ix], (data & mask) == 0 ? PRESS_KEY : RELEASE_KEY);
+    if (changes != 0) {
+
+        TRACE(JOY_PORT, data);
+        latency.arm(LATENCY_JOYSTICK, edgeStamp);
+
+        uint8_t mask = 1;
+
+        for (uint8_t ix = 0; ix < JOYSTICK_ACTIONS; ix++) {
+            if ((changes & mask) != 0) {
+                kbd->handleKey(
+                    map[ix], (data & mask) == 0 ? PRESS_KEY : RELEASE_KEY);
+            }
+            mask <<= 1;
         }
-        mask <<= 1;
+
+        latency.disarm();
+        state ^= changes;
     }
 
-    state = data;
+    // Settled when no counter is running. The port is checked once more with
+    // interrupts off, so that an edge since sampling doesn't get lost.
+    if ((count0 | count1) == 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if ((PINC & JOYSTICK_ALL) == state) {
+                pending = false;
+            }
+        }
+    }
 }
 
 //
 void Joystick::setMap(uint8_t m[JOYSTICK_ACTIONS]) {
     for (uint8_t ix = 0; ix < JOYSTICK_ACTIONS; ix++) {
-        DPRINTLN("[ JOY] mapping action " + String(ix) +
-            " to key " + String(m[ix]));
+        TRACE(JOY_MAP, ix, m[ix]);
         map[ix] = m[ix];
     }
 }
@@ -32,20 +32,27 @@ static const uint8_t JOYSTICK_ALL      = B00011111;
 
 static const uint8_t JOYSTICK_ACTIONS = 5;
 
-static const uint8_t DEFAULT_MAP[JOYSTICK_ACTIONS] = {K_Q, K_A, K_N, K_M, K_Z};
+static const uint8_t DEFAULT_MAP[JOYSTICK_ACTIONS] PROGMEM = {
+    K_Q, K_A, K_N, K_M, K_Z};
 
-//
+// Joystick on port C. Edges on its pins are caught via the pin change
+// interrupt, so the port only gets looked at while a change is settling.
 class Joystick {
 
 private:
     uint8_t map[JOYSTICK_ACTIONS];
-    uint8_t state;
+    uint8_t state;  // debounced port bits, a bit is 0 while pressed
+    // Vertical counters, i.e. bit n of count0 and count1 form a two bit
+    // counter for port bit n, counting the ticks in a row in which the port
+    // bit differed from its debounced state.
+    uint8_t count0 = 0;
+    uint8_t count1 = 0;
 
 public:
     Joystick();
     void reset();
     void setMap(uint8_t m[JOYSTICK_ACTIONS]);
-    void process(uint8_t port, TargetKbd *kbd);
+    void process(TargetKbd *kbd);
 };
 
 #endif
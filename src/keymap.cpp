@@ -17,7 +17,7 @@
 #include "keymap.h"
 
 //
-KeyMap::KeyMap(uint8_t *m, uint8_t l) {
+KeyMap::KeyMap(const uint8_t *m, uint8_t l) {
     map = m;
     length = l;
 }
@@ -35,7 +35,7 @@ bool KeyMap::isAssigned(uint8_t code) {
 //
 uint8_t KeyMap::translate(uint8_t code) {
     if (isValidIndex(code)) {
-        return map[code];
+        return pgm_read_byte(&map[code]);
     }
     return NA;
 }
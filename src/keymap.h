@@ -21,17 +21,17 @@
 
 #include "config.h"
 
-//
+// Translates input key codes to target key addresses, via a table in flash.
 class KeyMap {
 
 private:
-    uint8_t *map;
+    const uint8_t *map;             // in flash
     uint8_t length;
 
     bool isValidIndex(uint8_t ix);
 
 public:
-    KeyMap(uint8_t *map, uint8_t length);
+    KeyMap(const uint8_t *map, uint8_t length);
     bool isAssigned(uint8_t code);
     uint8_t translate(uint8_t code);
 };
@@ -0,0 +1,120 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "latency.h"
+
+Latency latency;
+
+// Starts the time base, and clears the histograms.
+void Latency::begin() {
+    startTimer();
+    reset();
+}
+
+// Starts Timer1 in normal mode, i.e. counting up and wrapping around. No
+// interrupts are used. Can be called more than once.
+void Latency::startTimer() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR1A = 0;
+        TCCR1B = (1 << CS11) | (1 << CS10);
+    }
+}
+
+//
+void Latency::reset() {
+    memset(histograms, 0, sizeof(histograms));
+    for (uint8_t s = 0; s < LATENCY_SOURCES; s++) {
+        histograms[s].min = 0xffff;
+    }
+    disarm();
+}
+
+// Arms the recorder for an event from given source that entered the adapter
+// at time `ingress`, as obtained from now().
+void Latency::arm(LatencySource s, uint16_t ingress) {
+    if (LATENCY_STATS) {
+        source = s;
+        stamp = ingress;
+    }
+}
+
+//
+void Latency::disarm() {
+    source = LATENCY_SOURCES;
+}
+
+// Called by TargetKbd right after strobing a switch into the MT88xx.
+void Latency::strobed() {
+    if (source < LATENCY_SOURCES) {
+        record(&histograms[source], now() - stamp);
+        disarm();
+    }
+}
+
+//
+void Latency::record(LatencyHistogram *h, uint16_t counts) {
+
+    if (h->count < 0xffff) {
+        h->count++;
+    }
+    if (counts < h->min) {
+        h->min = counts;
+    }
+    if (counts > h->max) {
+        h->max = counts;
+    }
+
+    uint8_t b = 0;
+    for (uint16_t c = counts >> 1; c > 0 && b < LATENCY_BUCKETS - 1; c >>= 1) {
+        b++;
+    }
+
+    if (h->buckets[b] == 0xff) {
+        for (uint8_t ix = 0; ix < LATENCY_BUCKETS; ix++) {
+            h->buckets[ix] >>= 1;
+        }
+    }
+    h->buckets[b]++;
+}
+
+// Writes the histograms into `buf` for sending them to the host, and returns
+// the number of bytes written, or 0 if `buf` is too small. The layout is the
+// length of a timer count in µs, the number of buckets, and then for each
+// source in order of LatencySource, count, min & max (16 bit little endian),
+// followed by the bucket counts. min is 0xffff if there are no samples.
+uint8_t Latency::serialize(uint8_t *buf, uint8_t size) {
+
+    if (size < 2 + LATENCY_SOURCES * (6 + LATENCY_BUCKETS)) {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    *p++ = LATENCY_TICK_US;
+    *p++ = LATENCY_BUCKETS;
+
+    for (uint8_t s = 0; s < LATENCY_SOURCES; s++) {
+        LatencyHistogram *h = &histograms[s];
+        uint16_t v[] = {h->count, h->min, h->max};
+        for (uint8_t ix = 0; ix < array_len(v); ix++) {
+            *p++ = v[ix] & 0xff;
+            *p++ = v[ix] >> 8;
+        }
+        memcpy(p, h->buckets, LATENCY_BUCKETS);
+        p += LATENCY_BUCKETS;
+    }
+
+    return p - buf;
+}
@@ -0,0 +1,102 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef LATENCY_h
+#define LATENCY_h
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+#include "config.h"
+
+// input sources for which latency is recorded
+enum LatencySource {
+    LATENCY_SERIAL,
+    LATENCY_PS2,
+    LATENCY_JOYSTICK,
+    LATENCY_SOURCES
+};
+
+// Timer1 runs free with a prescaler of 64, i.e. one count every 4µs at 16MHz,
+// and wraps around after about 262ms.
+static const uint8_t LATENCY_TICK_US = 64000000UL / F_CPU;
+
+// Bucket 0 holds latencies below 2 timer counts, bucket n > 0 those from
+// 2^n up to 2^(n+1) counts. The last bucket also holds everything above.
+static const uint8_t LATENCY_BUCKETS = 12;
+
+/*
+    Latency histogram of one input source. Bucket counts are a byte each.
+    When a bucket would overflow, all buckets of the histogram are halved,
+    so the shape of the distribution, and with it the percentiles, are kept.
+    `count` is the total number of samples, and saturates.
+ */
+struct LatencyHistogram {
+    uint16_t count;
+    uint16_t min;                   // in timer counts
+    uint16_t max;                   // in timer counts
+    uint8_t buckets[LATENCY_BUCKETS];
+};
+
+/*
+    Records the time from when a key event entered the adapter, i.e. when it
+    was received by the PS/2 or UART interrupt, or when the joystick port was
+    sampled, until the MT88xx strobe that actually changed a switch for it.
+    Input sources take a time stamp with `now()` at ingress, and the main loop
+    arms the recorder with that stamp before handing the event to TargetKbd.
+    The first strobe afterwards completes the measurement. Events that don't
+    result in a strobe, e.g. a key that is already held or the trigger of a
+    macro, are not recorded.
+ */
+class Latency {
+
+private:
+    LatencyHistogram histograms[LATENCY_SOURCES];
+    uint8_t source = LATENCY_SOURCES;   // armed source, if any
+    uint16_t stamp = 0;
+
+    void record(LatencyHistogram *h, uint16_t counts);
+
+public:
+    void begin();
+    void reset();
+
+    // Sets up Timer1 as the free running time base of now(). Anything taking
+    // time stamps or timing with Timer1, e.g. the PS/2 library, needs this
+    // before it starts, regardless of whether begin() has been called yet.
+    // Without it, the Arduino core leaves Timer1 in 8 bit PWM mode, where
+    // compare values above 255 never match.
+    static void startTimer();
+
+    void arm(LatencySource s, uint16_t ingress);
+    void disarm();
+    void strobed();
+    bool isArmed() { return source < LATENCY_SOURCES; }
+    uint8_t serialize(uint8_t *buf, uint8_t size);
+
+    // Returns the current time in timer counts. Also safe to use from ISRs.
+    static inline uint16_t now() {
+        uint16_t t;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            t = TCNT1;
+        }
+        return t;
+    }
+};
+
+extern Latency latency;
+
+#endif
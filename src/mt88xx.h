@@ -20,29 +20,249 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "pgmtable.h"
 
-// masks within PORTD
-static const uint8_t MASK_RESET  = B00100000;
-static const uint8_t MASK_DATA   = B01000000;
-static const uint8_t MASK_STROBE = B10000000;
-// masks within PORTB
-static const uint8_t MASK_AX     = B00000111;
-static const uint8_t MASK_AY     = B00111000;
-// masks within PORTC
-static const uint8_t MASK_AX3    = B00100000;
-
-//
+/*
+    Driver for the MT88xx switch matrix bus. Chip type and wiring are template
+    parameters, so that everything about the pins is known at compile time.
+    The port bits for each address are computed by the compiler, and kept in
+    a flash table per port. A switch update then boils down to a table lookup
+    and a single store per involved port for address & data, followed by the
+    strobe pulse. The wiring used by spectratur is at the end of this file.
+    To run on a different board, or with different wiring, only that typedef
+    needs to change.
+
+    Timing is derived from F_CPU and the data sheet minimums. The MT88xx
+    latches address & data on the strobe pulse, so intermediate states of the
+    address lines while we set them up, e.g. when they are spread across two
+    ports, don't matter.
+ */
+
+// --- ports & pins -----------------------------------------------------------
+
+#define MT88XX_PORT(P) \
+    struct Port##P { \
+        static decltype((PORT##P)) out() { return PORT##P; } \
+    };
+
+#ifdef PORTA
+MT88XX_PORT(A)
+#endif
+#ifdef PORTB
+MT88XX_PORT(B)
+#endif
+#ifdef PORTC
+MT88XX_PORT(C)
+#endif
+#ifdef PORTD
+MT88XX_PORT(D)
+#endif
+#ifdef PORTE
+MT88XX_PORT(E)
+#endif
+#ifdef PORTF
+MT88XX_PORT(F)
+#endif
+
+// a pin, given by its port and bit number within that port
+template<typename P, uint8_t B> struct Pin {
+    typedef P Port;
+    static const uint8_t MASK = 1 << B;
+};
+
+// placeholder for a pin that's not connected
+struct NoPin {
+    typedef void Port;
+    static const uint8_t MASK = 0;
+};
+
+// --- chips ------------------------------------------------------------------
+
+// AX_BITS is the number of AX address lines
+struct MT8808 { static const uint8_t AX_BITS = 3; };
+struct MT8812 { static const uint8_t AX_BITS = 4; };
+struct MT8816 { static const uint8_t AX_BITS = 4; };
+
+// data sheet minimums, in ns
+static const uint16_t MT88XX_STROBE_PULSE_NS = 20;
+static const uint16_t MT88XX_RESET_PULSE_NS  = 40;
+
+// --- compile time helpers ---------------------------------------------------
+
+namespace mt88xx_detail {
+
+template<typename A, typename B> struct SamePort {
+    static const bool value = false;
+};
+template<typename A> struct SamePort<A, A> {
+    static const bool value = true;
+};
+
+template<typename... Ps> struct PinList {};
+template<typename P> struct PortTag {};
+
+template<bool B> struct Flag {};
+
+template<bool C, typename A, typename B> struct Select { typedef A type; };
+template<typename A, typename B> struct Select<false, A, B> { typedef B type; };
+
+// number of CPU cycles covering at least ns nanoseconds
+constexpr uint32_t cycles(uint16_t ns) {
+    return (F_CPU / 1000000UL * ns + 999) / 1000;
+}
+
+// mask of all given pins located on Port
+template<typename Port> constexpr uint8_t maskOn() {
+    return 0;
+}
+template<typename Port, typename P, typename... Ps> constexpr uint8_t maskOn() {
+    return (SamePort<Port, typename P::Port>::value ? P::MASK : 0)
+        | maskOn<Port, Ps...>();
+}
+
+// Port bits for value a, where bit n of a goes to the n-th of the given pins.
+template<typename Port> constexpr uint8_t bitsOn(uint8_t) {
+    return 0;
+}
+template<typename Port, typename P, typename... Ps>
+constexpr uint8_t bitsOn(uint8_t a) {
+    return ((SamePort<Port, typename P::Port>::value && (a & 1)) ? P::MASK : 0)
+        | bitsOn<Port, Ps...>(a >> 1);
+}
+
+// generator for the PgmTable of Port bits per address
+template<typename Port, typename... Ps> struct AddressBits {
+    static constexpr uint8_t at(uint8_t a) {
+        return bitsOn<Port, Ps...>(a);
+    }
+};
+
+// whether any of the given pins is located on Port
+template<typename Port> constexpr bool isUsed() {
+    return false;
+}
+template<typename Port, typename P, typename... Ps> constexpr bool isUsed() {
+    return SamePort<Port, typename P::Port>::value || isUsed<Port, Ps...>();
+}
+
+} // namespace mt88xx_detail
+
+// --- driver -----------------------------------------------------------------
+
+/*
+    Address pins are given in order AX0, AX1, AX2, AX3, AY0, AY1, AY2, i.e.
+    in the bit order of key addresses (see config.h). AX3 is only used with
+    MT8812 & MT8816.
+ */
+template<typename Chip, typename Reset, typename Strobe, typename Data,
+    typename... Address>
 class MT88xx {
 
+    static_assert(sizeof...(Address) == 7, "need 7 address pins");
+
 private:
-    void setAddress(uint8_t a);
-    void setData(bool on);
-    void strobe();
+    static const uint32_t STROBE_CYCLES =
+        mt88xx_detail::cycles(MT88XX_STROBE_PULSE_NS);
+    static const uint32_t RESET_CYCLES =
+        mt88xx_detail::cycles(MT88XX_RESET_PULSE_NS);
+
+    // Port bits for address a, looked up in the table for Port. Ports without
+    // address pins don't get a table.
+    template<typename Port>
+    static inline uint8_t addressBits(uint8_t a, mt88xx_detail::Flag<true>) {
+        return PgmTable<mt88xx_detail::AddressBits<Port, Address...>, 128>
+            ::read(a & B01111111);
+    }
+
+    template<typename Port>
+    static inline uint8_t addressBits(uint8_t, mt88xx_detail::Flag<false>) {
+        return 0;
+    }
+
+    // Sets address & data bits on Port with a single store. The store is
+    // guarded against interrupts, since other pins on the same port may be
+    // changed from ISRs.
+    template<typename Port>
+    static inline void writePort(uint8_t a, bool on,
+        mt88xx_detail::PortTag<Port>) {
+        using namespace mt88xx_detail;
+        const uint8_t dataMask = maskOn<Port, Data>();
+        const uint8_t mask = maskOn<Port, Address...>() | dataMask;
+        uint8_t bits = addressBits<Port>(a,
+            Flag<isUsed<Port, Address...>()>()) | (on ? dataMask : 0);
+        uint8_t sreg = SREG;
+        cli();
+        Port::out() = (Port::out() & ~mask) | bits;
+        SREG = sreg;
+    }
+
+    // unconnected pins
+    static inline void writePort(uint8_t, bool,
+        mt88xx_detail::PortTag<void>) {}
+
+    // Writes each port used by the given pins exactly once.
+    static inline void writePorts(uint8_t, bool,
+        mt88xx_detail::PinList<>) {}
+
+    template<typename P, typename... Ps>
+    static inline void writePorts(uint8_t a, bool on,
+        mt88xx_detail::PinList<P, Ps...>) {
+        if (!mt88xx_detail::isUsed<typename P::Port, Ps...>()) {
+            writePort(a, on, mt88xx_detail::PortTag<typename P::Port>());
+        }
+        writePorts(a, on, mt88xx_detail::PinList<Ps...>());
+    }
+
+    //
+    template<uint32_t CYCLES, typename R>
+    static inline void pulse(uint8_t mask, R& port) {
+        port |= mask;
+        __builtin_avr_delay_cycles(CYCLES);
+        port &= ~mask;
+    }
 
 public:
-    MT88xx();
-    void reset();
-    void setSwitch(uint8_t address, bool state);
+    //
+    void reset() {
+        TRACE(MT88XX_RESET);
+        pulse<RESET_CYCLES>(Reset::MASK, Reset::Port::out());
+    }
+
+    // Sets the switch at address to state. Addresses have AX in the lower
+    // four bits, and AY in bits 4 through 6. For MT8808, AX3 is ignored.
+    inline void setSwitch(uint8_t address, bool state) {
+        if (Chip::AX_BITS < 4) {
+            address &= ~B00001000;
+        }
+        writePorts(address, state,
+            mt88xx_detail::PinList<Data, Address...>());
+        pulse<STROBE_CYCLES>(Strobe::MASK, Strobe::Port::out());
+    }
 };
 
+// --- wiring -----------------------------------------------------------------
+
+#if MT88XX == 8812
+typedef MT8812 MT88xxChip;
+#elif MT88XX == 8816
+typedef MT8816 MT88xxChip;
+#else
+typedef MT8808 MT88xxChip;
+#endif
+
+// see pin assignments in setup() in spectratur.ino
+typedef MT88xx<MT88xxChip,
+    Pin<PortD, 5>,  // RESET
+    Pin<PortD, 7>,  // STROBE
+    Pin<PortD, 6>,  // DATA
+    Pin<PortB, 0>,  // AX0
+    Pin<PortB, 1>,  // AX1
+    Pin<PortB, 2>,  // AX2
+    mt88xx_detail::Select<MT88xxChip::AX_BITS == 4,
+        Pin<PortC, 5>, NoPin>::type, // AX3
+    Pin<PortB, 3>,  // AY0
+    Pin<PortB, 4>,  // AY1
+    Pin<PortB, 5>   // AY2
+> MT88xxBus;
+
 #endif
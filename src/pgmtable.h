@@ -0,0 +1,74 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef PGMTABLE_h
+#define PGMTABLE_h
+
+#include <Arduino.h>
+
+/*
+    Lookup tables in flash whose content is computed at compile time. The
+    generator `G` needs to provide a function
+
+        static constexpr uint8_t at(uint8_t ix);
+
+    which is evaluated by the compiler for each index from 0 to `N` - 1, with
+    `N` at most 256. This way, tables can be derived from other tables, e.g.
+    by composing two maps, without the source tables ending up in the image,
+    as long as they are `constexpr` and not used anywhere else.
+
+    Reading past the end of a table gives `Missing`, by default 0xff, i.e.
+    `NA`. This header doesn't depend on config.h, so that the PS/2 library can
+    use it as well. The firmware is built as
+    C++11, so there is no std::index_sequence, and constexpr functions are
+    limited to a single return statement.
+ */
+
+namespace pgmtable_detail {
+
+template<uint8_t... Is> struct Indices {};
+
+template<uint16_t N, uint8_t... Is>
+struct MakeIndices : MakeIndices<N - 1, N - 1, Is...> {};
+
+template<uint8_t... Is>
+struct MakeIndices<0, Is...> {
+    typedef Indices<Is...> Type;
+};
+
+} // namespace pgmtable_detail
+
+//
+template<typename G, uint16_t N, uint8_t Missing = 0xff,
+    typename I = typename pgmtable_detail::MakeIndices<N>::Type>
+struct PgmTable;
+
+//
+template<typename G, uint16_t N, uint8_t Missing, uint8_t... Is>
+struct PgmTable<G, N, Missing, pgmtable_detail::Indices<Is...> > {
+
+    static const uint8_t data[N];
+
+    static inline uint8_t read(uint8_t ix) {
+        return ix < N ? pgm_read_byte(&data[ix]) : Missing;
+    }
+};
+
+template<typename G, uint16_t N, uint8_t Missing, uint8_t... Is>
+const uint8_t PgmTable<G, N, Missing, pgmtable_detail::Indices<Is...> >
+    ::data[N] PROGMEM = {G::at(Is)...};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "scheduler.h"
+
+// Timer2 runs with a prescaler of 64, i.e. one timer count every 4µs at
+// 16MHz; up to 256 counts per tick
+static const uint16_t TICK_COUNTS = SCHEDULER_TICK_US / (64000000UL / F_CPU);
+
+static volatile uint16_t tickCount = 0;
+
+//
+ISR(TIMER2_COMPA_vect) {
+    tickCount++;
+}
+
+//
+Scheduler::Scheduler() {}
+
+// Sets up Timer2 for generating the tick, in CTC mode.
+void Scheduler::begin() {
+    TRACE(SCHD_START, SCHEDULER_TICK_US);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR2A = (1 << WGM21);
+        TCCR2B = (1 << CS22);
+        TCNT2 = 0;
+        OCR2A = TICK_COUNTS - 1;
+        TIMSK2 = (1 << OCIE2A);
+        tickCount = 0;
+    }
+    set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+//
+uint16_t Scheduler::ticks() {
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = tickCount;
+    }
+    return t;
+}
+
+// Adds a task that is run every `period` ticks. Tasks need to be added in
+// order of descending priority.
+bool Scheduler::add(TaskFunc f, uint16_t period) {
+
+    if (count == array_len(tasks)) {
+        TRACE(SCHD_TOO_MANY);
+        return false;
+    }
+
+    Task *t = &tasks[count++];
+    t->func = f;
+    t->period = period > 0 ? period : 1;
+    t->due = ticks();
+    t->maxLate = 0;
+    t->maxRun = 0;
+    t->misses = 0;
+    return true;
+}
+
+//
+bool Scheduler::isDue(Task *t, uint16_t now) {
+    return (int16_t)(now - t->due) >= 0;
+}
+
+//
+Task *Scheduler::nextDue() {
+    uint16_t now = ticks();
+    for (uint8_t ix = 0; ix < count; ix++) {
+        if (isDue(&tasks[ix], now)) {
+            return &tasks[ix];
+        }
+    }
+    return NULL;
+}
+
+// Runs all tasks that are due, highest priority first, then sleeps until the
+// next interrupt. This is to be called from the main loop.
+void Scheduler::run() {
+
+    Task *t;
+
+    while ((t = nextDue()) != NULL) {
+
+        uint16_t late = ticks() - t->due;
+        if (late > t->maxLate) {
+            t->maxLate = late;
+        }
+        if (late >= t->period) {
+            t->misses++;
+            t->due += (late / t->period) * t->period; // skip missed periods
+        }
+        t->due += t->period;
+
+        unsigned long start = micros();
+        t->func();
+        unsigned long elapsed = micros() - start;
+        if (elapsed > t->maxRun) {
+            t->maxRun = elapsed > 0xffff ? 0xffff : elapsed;
+        }
+    }
+
+    // Interrupts are disabled before checking, and only re-enabled right
+    // before going to sleep. Since the instruction following `sei` is always
+    // executed, a tick that occurs in between will wake us up again.
+    cli();
+    if (nextDue() == NULL) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+//
+void Scheduler::resetStats() {
+    for (uint8_t ix = 0; ix < count; ix++) {
+        tasks[ix].maxLate = 0;
+        tasks[ix].maxRun = 0;
+        tasks[ix].misses = 0;
+    }
+}
+
+// Reports worst case start delay & execution time for each task.
+void Scheduler::report() {
+    for (uint8_t ix = 0; ix < count; ix++) {
+        TRACE(SCHD_TASK, ix, tasks[ix].maxLate, tasks[ix].maxRun);
+        TRACE(SCHD_MISSES, ix, tasks[ix].misses);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SCHEDULER_h
+#define SCHEDULER_h
+
+#include <Arduino.h>
+
+#include "config.h"
+
+#if SCHEDULER_TICK_US % 4 != 0 || SCHEDULER_TICK_US < 4 \
+    || SCHEDULER_TICK_US > 1024
+#error "SCHEDULER_TICK_US must be a multiple of 4 between 4 and 1024"
+#endif
+
+//
+typedef void (*TaskFunc)();
+
+/*
+    A task is run once every `period` ticks. The deadline for a task is the
+    start of its next period, i.e. a task that could not be started before
+    it became due again counts as a deadline miss.
+ */
+struct Task {
+    TaskFunc func;
+    uint16_t period;    // in ticks
+    uint16_t due;       // tick at which task is due next
+    uint16_t maxLate;   // worst case start delay in ticks
+    uint16_t maxRun;    // worst case execution time in µs
+    uint16_t misses;    // number of deadline misses
+};
+
+/*
+    Cooperative scheduler with a fixed tick generated by Timer2. Tasks are
+    kept in priority order, i.e. tasks added first have highest priority.
+    Whenever a task has run, the scheduler starts over with the highest
+    priority task, so a long running low priority task can delay a high
+    priority task by at most its own execution time. When no task is due, the
+    MCU is put into idle sleep until the next interrupt.
+ */
+class Scheduler {
+
+private:
+    Task tasks[SCHEDULER_MAX_TASKS];
+    uint8_t count = 0;
+
+    bool isDue(Task *t, uint16_t now);
+    Task *nextDue();
+
+public:
+    Scheduler();
+    void begin();
+    bool add(TaskFunc f, uint16_t period);
+    void run();
+    void resetStats();
+    void report();
+    static uint16_t ticks();
+};
+
+#endif
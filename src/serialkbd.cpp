@@ -23,36 +23,36 @@ SerialKbd::SerialKbd() {
 
 //
 void SerialKbd::reset() {
-    DPRINTLN("[ SER] resetting");
+    TRACE(SER_RESET);
     joystickMapIx = -1;
 }
 
 //
-void SerialKbd::process(uint8_t readBuf[2], TargetKbd *kbd, Joystick *joy) {
+void SerialKbd::process(
+    uint8_t readBuf[FRAME_LENGTH], TargetKbd *kbd, Joystick *joy) {
 
     uint8_t makeBreak = readBuf[0];
     uint8_t code = readBuf[1];
     KeyAction a;
 
     switch (makeBreak) {
-        case 0: // break
+        case FRAME_BREAK:
             a = RELEASE_KEY;
             break;
-        case 1: // make
+        case FRAME_MAKE:
             a = PRESS_KEY;
             break;
         default:
-            DPRINTLN("[ SER] illegal make/break code: " + String(makeBreak));
+            TRACE(SER_ILLEGAL, makeBreak);
             return;
     }
 
     uint8_t key = map->translate(code);
-    DPRINTLN("[ SER] action: " + String(a) + ", code: " + String(code) +
-        ", key: " + String(key));
+    TRACE(SER_KEY, a, code, key);
 
     if (code == 59) { // start joystick map setup (F1); TODO: make configurable
         if (a == RELEASE_KEY && joy != NULL) {
-            DPRINTLN("[ SER] setting joystick");
+            TRACE(SER_JOY_MAP_START);
             joystickMapIx = 0;
         }
 
@@ -60,7 +60,7 @@ void SerialKbd::process(uint8_t readBuf[2], TargetKbd *kbd, Joystick *joy) {
         kbd->handleKey(key, a);
 
     } else if (a == RELEASE_KEY) { // collecting joystick map
-        DPRINTLN("[ SER] joystick setup " + String(key));
+        TRACE(SER_JOY_MAP, key);
         joystickMap[joystickMapIx++] = key;
         if (joystickMapIx == array_len(joystickMap)) {
             joystickMapIx = -1;
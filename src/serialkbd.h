@@ -22,6 +22,7 @@
 #include "config.h"
 #include "joystick.h"
 #include "keymap.h"
+#include "serialproto.h"
 #include "targetkbd.h"
 
 //
@@ -35,7 +36,7 @@ private:
 public:
     SerialKbd();
     void reset();
-    void process(uint8_t readBuf[2], TargetKbd *kbd, Joystick *joy);
+    void process(uint8_t readBuf[FRAME_LENGTH], TargetKbd *kbd, Joystick *joy);
 };
 
 #endif
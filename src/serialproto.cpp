@@ -0,0 +1,250 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "serialproto.h"
+
+// Baud rates selectable via `CMD_BAUD`. 500k and 1M can be generated exactly
+// from a 16MHz clock.
+static const unsigned long BAUD_RATES[] = {SERIAL_BAUD, 500000, 1000000};
+
+//
+SerialProtocol::SerialProtocol(Uart *u) {
+    port = u;
+}
+
+// Resets parser state, protocol version, and baud rate.
+void SerialProtocol::reset() {
+    partial = false;
+    setDefaults();
+}
+
+//
+void SerialProtocol::setDefaults() {
+    version = 1;
+    baudPending = false;
+    if (baudCode != 0) {
+        baudCode = 0;
+        port->flush();
+        port->begin(BAUD_RATES[0]);
+    }
+}
+
+//
+bool SerialProtocol::isCommand(uint8_t b) {
+    switch (b) {
+        case CMD_HELLO:
+        case CMD_RESET:
+        case CMD_HISTOGRAM:
+        case CMD_PING:
+            return true;
+        case CMD_BAUD:
+            return version > 1;
+    }
+    return false;
+}
+
+// Returns the length of the frame starting with given lead byte, or 0 if the
+// lead byte is not valid.
+uint8_t SerialProtocol::getFrameLength(uint8_t lead) {
+    if (version == 1) {
+        return (lead == FRAME_BREAK || lead == FRAME_MAKE || isCommand(lead))
+            ? FRAME_LENGTH : 0;
+    }
+    return lead == FRAME_ESCAPE ? FRAME_LENGTH + 1 : 1;
+}
+
+// Reads a byte from the UART, and accounts for it in flow control.
+uint8_t SerialProtocol::read() {
+    consumed++;
+    return port->read();
+}
+
+// Returns whether a partial frame has been waiting for its remaining bytes
+// for too long.
+bool SerialProtocol::isStale() {
+    if (!partial) {
+        partial = true;
+        partialSince = millis();
+        return false;
+    }
+    return (millis() - partialSince) >= SERIAL_FRAME_TIMEOUT;
+}
+
+// Gets the next complete frame from the UART. Returns false if there is none.
+// Call repeatedly to drain all frames that have been received.
+bool SerialProtocol::next(uint8_t frame[FRAME_LENGTH]) {
+
+    int16_t lead;
+
+    while ((lead = port->peek()) >= 0) {
+
+        uint8_t len = getFrameLength(lead);
+
+        if (len == 0) {
+            TRACE(SER_BAD_LEAD, lead);
+            read();
+            badFrames++;
+            partial = false;
+            continue;
+        }
+
+        if (port->available() < len) {
+            if (isStale()) {
+                TRACE(SER_INCOMPLETE);
+                read();
+                badFrames++;
+                partial = false;
+                continue;
+            }
+            return false;
+        }
+
+        partial = false;
+        frameStamp = port->getRxStamp();
+
+        if (len == 1) { // version 2 key event
+            uint8_t b = read();
+            frame[0] = (b & FRAME_V2_MAKE) ? FRAME_MAKE : FRAME_BREAK;
+            frame[1] = b & ~FRAME_V2_MAKE;
+
+        } else {
+            if (len > FRAME_LENGTH) { // version 2 control frame
+                read();
+                if (!isCommand(port->peek())) {
+                    TRACE(SER_BAD_CONTROL);
+                    read();
+                    read();
+                    badFrames++;
+                    continue;
+                }
+            }
+            frame[0] = read();
+            frame[1] = read();
+        }
+
+        baudPending = false; // got valid frame, new baud rate confirmed
+        return true;
+    }
+
+    return false;
+}
+
+// Returns the time at which the frame last returned by next() arrived, as
+// given by Latency::now(). For frames that arrived in a burst, this is the
+// arrival time of the burst.
+uint16_t SerialProtocol::getFrameStamp() {
+    return frameStamp;
+}
+
+//
+uint8_t SerialProtocol::getVersion() {
+    return version;
+}
+
+// Sets the protocol version to use, as requested by the host. If the version
+// is not supported, the highest supported version is used. Returns the
+// version in effect.
+uint8_t SerialProtocol::setVersion(uint8_t v) {
+    version = v < 1 ? 1 : (v > PROTOCOL_VERSION ? PROTOCOL_VERSION : v);
+    TRACE(SER_VERSION, version);
+    return version;
+}
+
+// Returns the baud rate for given code, or 0 if the code is invalid.
+unsigned long SerialProtocol::getBaudRate(uint8_t code) {
+    return code < array_len(BAUD_RATES) ? BAUD_RATES[code] : 0;
+}
+
+// Switches to the baud rate with given code, after all pending output has
+// been sent. The new baud rate needs to be confirmed by the host by sending
+// a valid frame, see checkBaud().
+bool SerialProtocol::switchBaud(uint8_t code) {
+
+    if (getBaudRate(code) == 0) {
+        return false;
+    }
+
+    port->flush();
+    // Setting up the UART again clears the receive buffer. Anything left in
+    // there is dropped here, so that its credits are returned to the host.
+    while (port->available()) {
+        read();
+    }
+    port->begin(getBaudRate(code));
+    baudCode = code;
+    baudPending = code != 0;
+    baudSince = millis();
+    partial = false;
+    return true;
+}
+
+// Reverts to defaults if a baud rate switch has not been confirmed in time.
+// This needs to be called regularly.
+void SerialProtocol::checkBaud() {
+    if (baudPending
+        && (millis() - baudSince) >= SERIAL_BAUD_CONFIRM_TIMEOUT) {
+        TRACE(SER_BAUD_REVERT);
+        setDefaults();
+    }
+}
+
+// Sends a binary frame to the host. Only available in version 2.
+void SerialProtocol::sendFrame(
+    uint8_t type, const uint8_t *payload, uint8_t len) {
+
+    if (version < 2) {
+        return;
+    }
+
+    port->write(FRAME_ESCAPE);
+    port->write(type);
+    port->write(len);
+    port->write(payload, len);
+}
+
+//
+void SerialProtocol::sendCredits(uint8_t credits) {
+    sendFrame(REPLY_CREDITS, &credits, 1);
+    lastGrant = millis();
+}
+
+// Grants the host credits for the free space in the receive buffer. To be
+// called after replying to hello.
+void SerialProtocol::grantInitialCredits() {
+    consumed = 0;
+    sendCredits(UART_RX_BUFFER_SIZE - 1 - port->available());
+}
+
+// Grants the host credits for all bytes processed since the last grant. To
+// limit the overhead, credits are only granted once a batch has accumulated,
+// or after a while. This needs to be called regularly.
+void SerialProtocol::grantCredits() {
+    if (consumed >= SERIAL_CREDIT_BATCH || (consumed > 0
+        && (millis() - lastGrant) >= SERIAL_CREDIT_INTERVAL)) {
+        sendCredits(consumed);
+        consumed = 0;
+    }
+}
+
+//
+uint16_t SerialProtocol::getBadFrames() {
+    return badFrames;
+}
+
+//
+void SerialProtocol::resetStats() {
+    badFrames = 0;
+}
@@ -0,0 +1,128 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SERIALPROTO_h
+#define SERIALPROTO_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "uart.h"
+
+// first byte of a frame, key events
+static const uint8_t FRAME_BREAK = 0;
+static const uint8_t FRAME_MAKE  = 1;
+// first byte of a frame, control commands
+static const uint8_t CMD_HELLO   = '?';
+static const uint8_t CMD_RESET   = '!';
+static const uint8_t CMD_BAUD    = 'b';
+static const uint8_t CMD_HISTOGRAM = 'h';
+static const uint8_t CMD_PING    = 'p';
+
+// protocol version 2: lead byte of control frames, and make flag
+static const uint8_t FRAME_ESCAPE = 0;
+static const uint8_t FRAME_V2_MAKE = B10000000;
+
+// protocol version 2: types of frames sent to the host
+static const uint8_t REPLY_CREDITS = 'c';
+static const uint8_t REPLY_HISTOGRAM = 'h';
+static const uint8_t REPLY_PING = 'p';
+static const uint8_t REPLY_TRACE = 't';     // debug mode, see trace.h
+
+static const uint8_t FRAME_LENGTH = 2;
+static const uint8_t PROTOCOL_VERSION = 2; // highest supported version
+
+/*
+    Parser for the frames sent by the host. There are two protocol versions:
+
+    1.  Each frame consists of two bytes, a lead byte identifying the frame
+        type, i.e. key make/break or a control command, and an argument byte.
+        This is the default after start-up & reset.
+
+    2.  Each key event is a single byte, with bit 7 set for make, and the key
+        code in the lower 7 bits. Control frames are the same as in version 1,
+        but preceded by `FRAME_ESCAPE`.
+
+    The host requests a version with the `CMD_HELLO` command, whose argument
+    is the desired version. Regardless of version, the parser hands out
+    frames in version 1 format.
+
+    The parser re-synchronizes after a corrupted frame. A lead byte that is
+    not valid is dropped, and so is a partial frame whose remaining bytes did
+    not arrive within `SERIAL_FRAME_TIMEOUT`, since the host always sends
+    complete frames.
+
+    In version 2, the adapter also sends binary frames to the host. These
+    start with `FRAME_ESCAPE`, followed by frame type, payload length, and the
+    payload. Text replies never contain a zero byte, so the host can tell
+    the two apart. Flow control is credit based: on hello, the adapter grants
+    credits for as many bytes as fit into the receive buffer. The host must
+    not send more bytes than it has credits for. As received bytes are
+    processed, the adapter grants new credits with `REPLY_CREDITS` frames.
+
+    In version 2, the host can query latency statistics with the
+    `CMD_HISTOGRAM` command, see latency.h. They are sent back in a
+    `REPLY_HISTOGRAM` frame. If bit 0 of the argument is set, the statistics
+    are reset afterwards.
+
+    Also in version 2, the host can measure the round trip time of the link
+    with the `CMD_PING` command. Its argument is echoed back in a `REPLY_PING`
+    frame once the command has made it through the main loop.
+
+    In version 2, the host can also switch to a higher baud rate with the
+    `CMD_BAUD` command. Unless a valid frame is received at the new baud rate
+    within `SERIAL_BAUD_CONFIRM_TIMEOUT`, the link is reverted to defaults.
+ */
+class SerialProtocol {
+
+private:
+    Uart *port;
+    uint8_t version = 1;
+    uint8_t baudCode = 0;
+    bool baudPending = false;
+    unsigned long baudSince = 0;
+    unsigned long partialSince = 0;
+    bool partial = false;
+    uint16_t badFrames = 0;
+    uint8_t consumed = 0;           // bytes processed since last grant
+    unsigned long lastGrant = 0;
+    uint16_t frameStamp = 0;        // arrival time of last frame
+
+    bool isCommand(uint8_t b);
+    uint8_t getFrameLength(uint8_t lead);
+    bool isStale();
+    void setDefaults();
+    uint8_t read();
+    void sendCredits(uint8_t credits);
+
+public:
+    SerialProtocol(Uart *u);
+    void reset();
+    bool next(uint8_t frame[FRAME_LENGTH]);
+    uint16_t getFrameStamp();
+    uint8_t getVersion();
+    uint8_t setVersion(uint8_t v);
+    unsigned long getBaudRate(uint8_t code);
+    bool switchBaud(uint8_t code);
+    void checkBaud();
+    void sendFrame(uint8_t type, const uint8_t *payload, uint8_t len);
+    void grantInitialCredits();
+    void grantCredits();
+    uint16_t getBadFrames();
+    void resetStats();
+};
+
+#endif
@@ -20,10 +20,14 @@
 #include "externalkbd.h"
 #include "serialkbd.h"
 #include "joystick.h"
+#include "latency.h"
+#include "scheduler.h"
+#include "serialproto.h"
 #include "targetkbd.h"
+#include "uart.h"
 
 
-static const uint8_t PS2_DATAPIN = 4;
+static const uint8_t PS2_DATAPIN = 4;  // see PS2_DATA_PIN_REG in PS/2 library
 static const uint8_t PS2_IRQPIN  = 3;
 
 
@@ -35,6 +39,28 @@ Joystick *joystick = NULL;
 // --- key sink ---------------------------------------------------------------
 TargetKbd *targetKbd = NULL;
 
+// --- host link --------------------------------------------------------------
+SerialProtocol *serialProto = NULL;
+
+// --- scheduling -------------------------------------------------------------
+Scheduler *scheduler = NULL;
+
+// --- prototypes -------------------------------------------------------------
+// The Arduino build generates these, but the simulator build compiles this
+// file as plain C++.
+void serialTask();
+void externalKbdTask();
+void joystickTask();
+void macroTask();
+void telemetryTask();
+void traceTask();
+bool handleSerial(uint8_t buf[FRAME_LENGTH]);
+void hello();
+void setBaud(uint8_t code);
+void sendHistogram(uint8_t flags);
+void ping(uint8_t seq);
+void reset();
+
 // ------------------------------------------------------------------ SETUP ---
 
 void setup() {
@@ -77,55 +103,129 @@ void setup() {
 
     targetKbd = new TargetKbd();
     serialKbd = new SerialKbd();
+    serialProto = new SerialProtocol(&uart);
 
     if (EXTERNAL_KBD) {
         externalKbd = new ExternalKbd(PS2_DATAPIN, PS2_IRQPIN);
+        if (EXTERNAL_KBD_FAST_LANE) {
+            externalKbd->enableFastLane(targetKbd);
+        }
     }
 
     if (JOYSTICK) {
         joystick = new Joystick();
     }
 
-    Serial.begin(115200);
+    uart.begin(SERIAL_BAUD);
+    latency.begin();
     reset();
+
+    // tasks in order of priority
+    scheduler = new Scheduler();
+    scheduler->add(serialTask, 1);
+    if (externalKbd != NULL) {
+        scheduler->add(externalKbdTask, 1);
+    }
+    if (joystick != NULL) {
+        scheduler->add(joystickTask, 1);
+    }
+    scheduler->add(macroTask, 1);
+    if (DEBUG) {
+        scheduler->add(telemetryTask, SCHEDULER_REPORT_TICKS);
+        scheduler->add(traceTask, 1);
+    }
+    scheduler->begin();
 }
 
 // ------------------------------------------------------------------- LOOP ---
 
 void loop() {
+    scheduler->run();
+}
 
-    if (Serial.available() > 1) {
-        uint8_t buf[2] = {0, 0};
-        Serial.readBytes(buf, 2);
+// ------------------------------------------------------------------ TASKS ---
+
+//
+void serialTask() {
+    serialProto->checkBaud();
+    uint8_t buf[FRAME_LENGTH];
+    while (serialProto->next(buf)) {
         if (!handleSerial(buf) && (serialKbd != NULL)) {
+            latency.arm(LATENCY_SERIAL, serialProto->getFrameStamp());
             serialKbd->process(buf, targetKbd, joystick);
+            latency.disarm();
         }
     }
+    serialProto->grantCredits();
+}
+
+//
+void externalKbdTask() {
+    externalKbd->process(targetKbd, joystick);
+}
+
+//
+void joystickTask() {
+    joystick->process(targetKbd);
+}
+
+//
+void macroTask() {
+    targetKbd->process();
+}
+
+//
+void telemetryTask() {
+    scheduler->report();
+    scheduler->resetStats();
+
+    UartStats s;
+    uart.getStats(&s);
+    TRACE(SER_STATS, s.framingErrors, s.dataOverruns, s.rxOverflows);
+    TRACE(SER_BAD_FRAMES, serialProto->getBadFrames());
+    uart.resetStats();
+    serialProto->resetStats();
 
     if (externalKbd != NULL) {
-        externalKbd->process(targetKbd, joystick);
+        PS2Stats p;
+        externalKbd->getStats(&p);
+        TRACE(PS2_STATS, p.overflows, p.parityErrors, p.resends);
+        externalKbd->resetStats();
     }
+}
 
-    if (joystick != NULL) {
-        joystick->process(PINC, targetKbd);
-    }
+//
+void traceTask() {
+#if DEBUG == true
+    trace.drain();
+#endif
 }
 
 // ----------------------------------------------------------------------------
 
 //
-bool handleSerial(uint8_t buf[2]) {
+bool handleSerial(uint8_t buf[FRAME_LENGTH]) {
 
-    DPRINTLN("[MAIN] serial: {"
-        + String(buf[0]) + ", " + String(buf[1]) + "}");
+    TRACE(MAIN_SERIAL, buf[0], buf[1]);
 
-    switch ((char)buf[0]) {
-        case '?':
+    switch (buf[0]) {
+        case CMD_HELLO:
+            serialProto->setVersion(buf[1]);
             hello();
+            serialProto->grantInitialCredits();
             break;
-        case '!':
+        case CMD_RESET:
             reset();
             break;
+        case CMD_BAUD:
+            setBaud(buf[1]);
+            break;
+        case CMD_HISTOGRAM:
+            sendHistogram(buf[1]);
+            break;
+        case CMD_PING:
+            ping(buf[1]);
+            break;
         default:
             return false;
     }
@@ -133,14 +233,49 @@ bool handleSerial(uint8_t buf[2]) {
     return true;
 }
 
-//
+// Replies to the host with our name, and the protocol version in use if
+// higher than 1.
 void hello() {
-    Serial.println("spectratur");
+    uart.print("spectratur");
+    if (serialProto->getVersion() > 1) {
+        uart.print(' ');
+        uart.print(serialProto->getVersion());
+    }
+    uart.println();
+}
+
+// Acknowledges a baud rate switch at the current rate, then switches.
+void setBaud(uint8_t code) {
+    unsigned long rate = serialProto->getBaudRate(code);
+    if (rate == 0) {
+        uart.println("baud ?");
+        return;
+    }
+    uart.print("baud ");
+    uart.println(rate);
+    serialProto->switchBaud(code);
+}
+
+// Sends the latency statistics to the host, and resets them if bit 0 of
+// flags is set.
+void sendHistogram(uint8_t flags) {
+    uint8_t buf[64];
+    serialProto->sendFrame(
+        REPLY_HISTOGRAM, buf, latency.serialize(buf, sizeof(buf)));
+    if (flags & 1) {
+        latency.reset();
+    }
+}
+
+// Echoes a ping from the host, for measuring the round trip time.
+void ping(uint8_t seq) {
+    serialProto->sendFrame(REPLY_PING, &seq, 1);
 }
 
 //
 void reset() {
-    DPRINTLN("[MAIN] resetting");
+    TRACE(MAIN_RESET);
+    serialProto->reset();
     serialKbd->reset();
     targetKbd->reset();
     if (externalKbd != NULL) {
@@ -14,6 +14,9 @@
     limitations under the License.
 */
 
+#include <util/atomic.h>
+
+#include "latency.h"
 #include "targetkbd.h"
 
 //
@@ -21,22 +24,49 @@ TargetKbd::TargetKbd() {}
 
 //
 void TargetKbd::reset() {
+    enter();
+    clearMacroQueue();
     clearKeyboardMatrix();
     mt88xx.reset();
+    leave();
+}
+
+// Marks the start of a change to the keyboard state. The atomic block keeps
+// the compiler from moving any of the change ahead of setting the flag.
+void TargetKbd::enter() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        busy = true;
+    }
 }
 
 //
-void TargetKbd::clearKeyboardMatrix() {
-    for (uint8_t ix = 0; ix < array_len(kbdMatrix); ix++) {
-        kbdMatrix[ix] = 0;
+void TargetKbd::leave() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        busy = false;
     }
 }
 
 //
+void TargetKbd::clearKeyboardMatrix() {
+    memset(kbdMatrix, 0, sizeof(kbdMatrix));
+    memset(desiredMatrix, 0, sizeof(desiredMatrix));
+    memset(toggleMatrix, 0, sizeof(toggleMatrix));
+    memset(keyRefs, 0, sizeof(keyRefs));
+    memset(heldKeys, 0, sizeof(heldKeys));
+}
+
+//
+void TargetKbd::clearMacroQueue() {
+    macroHead = 0;
+    macroCount = 0;
+    macroStep = 0;
+    macroKeyDown = false;
+}
+
+// Types the key via the macro player, i.e. the key is pressed and released
+// again asynchronously.
 void TargetKbd::typeKey(uint8_t k) {
-    pressKey(k);
-    delay(100);
-    releaseKey(k);
+    queueMacro(k);
 }
 
 //
@@ -54,50 +84,127 @@ void TargetKbd::releaseKey(uint8_t k) {
     handleKey(k, RELEASE_KEY);
 }
 
-//
+// Handles a key action coming from an input source. Presses of keys that are
+// already held, e.g. from typematic repeat, and releases of keys that aren't,
+// are ignored.
 void TargetKbd::handleKey(uint8_t k, KeyAction a) {
 
     if (k == NA) {
-        DPRINTLN("[TRGT] unassigned key");
+        TRACE(TRGT_UNASSIGNED);
         return;
     }
 
+    enter();
+
+    if (a != FLIP_KEY) {
+        bool press = a == PRESS_KEY;
+        if (isHeld(k) == press) {
+            leave();
+            return;
+        }
+        setHeld(k, press);
+    }
+
+    applyKey(k, a);
+    leave();
+}
+
+// Handles a key action right away, for input sources that handle events in
+// their ISR. Only plain keys are handled, and only while the main loop is not
+// changing the keyboard state. Returns false if the event needs to go through
+// the main loop instead, in which case nothing has been changed.
+bool TargetKbd::tryHandleKey(uint8_t k, KeyAction a) {
+
+    if (busy || !isValidKeyAddress(k)) {
+        return false;
+    }
+
+    handleKey(k, a);
+    return true;
+}
+
+// Applies a key action to the desired keyboard state, and commits the result
+// to the MT88xx. Each call is one elementary change, so combos get pressed
+// and released in the order of their keys.
+void TargetKbd::applyKey(uint8_t k, KeyAction a) {
+
     if (handleSpecial(k, a)) {
         return;
     }
 
     if (!isValidKeyAddress(k)) {
-        DPRINTLN("[TRGT] invalid key address: " + String(k));
+        TRACE(TRGT_INVALID_KEY, k);
         return;
     }
 
-    uint8_t ax = k & K_MASK_AX;
-    uint8_t ay = (k & K_MASK_AY) >> 4; // shift out 4 AX bits
-
-    bool data = false;
-
     switch (a) {
         case PRESS_KEY:
-            data = true;
+            if (keyRefs[k] < 0xff) {
+                keyRefs[k]++;
+            }
             break;
         case RELEASE_KEY:
-            data = false;
+            if (keyRefs[k] > 0) {
+                keyRefs[k]--;
+            }
             break;
         case FLIP_KEY:
-            data = !getKeyState(ax, ay);
-            DPRINTLN("[TRGT] flipping to: " + String(data));
+            toggleMatrix[k & K_MASK_AX] ^= 1 << ((k & K_MASK_AY) >> 4);
             break;
     }
 
-    DPRINTLN("[TRGT] key: " + String(k) + ", address: " + String(k) + ", ax: "
-        + String(ax) + ", ay: " + String(ay) + ", data: " + String(data));
+    TRACE(TRGT_KEY, k, a, keyRefs[k]);
+
+    updateDesired(k);
+    commit();
+}
 
-    mt88xx.setSwitch(k, data);
+// Updates the desired state of the switch for the given key address.
+void TargetKbd::updateDesired(uint8_t k) {
 
-    // track key's on/off state
-    setKeyState(ax, ay, data);
+    uint8_t ax = k & K_MASK_AX;
+    uint8_t bit = 1 << ((k & K_MASK_AY) >> 4); // shift out 4 AX bits
 
-    //delay(100);
+    if (keyRefs[k] > 0 || (toggleMatrix[ax] & bit)) {
+        desiredMatrix[ax] |= bit;
+    } else {
+        desiredMatrix[ax] &= ~bit;
+    }
+}
+
+// Strobes every switch whose desired state differs from its current state
+// into the MT88xx.
+void TargetKbd::commit() {
+
+    for (uint8_t ax = 0; ax < array_len(kbdMatrix); ax++) {
+
+        uint8_t diff = desiredMatrix[ax] ^ kbdMatrix[ax];
+
+        for (uint8_t ay = 0; diff; ay++, diff >>= 1) {
+            if (diff & 1) {
+                bool data = (desiredMatrix[ax] & (1 << ay)) != 0;
+                TRACE(TRGT_SWITCH, ax, ay, data);
+                mt88xx.setSwitch((ay << 4) | ax, data);
+                latency.strobed();
+            }
+        }
+
+        kbdMatrix[ax] = desiredMatrix[ax];
+    }
+}
+
+//
+bool TargetKbd::isHeld(uint8_t key) {
+    return (heldKeys[key >> 3] & (1 << (key & 7))) != 0;
+}
+
+//
+void TargetKbd::setHeld(uint8_t key, bool held) {
+    if (held) {
+        heldKeys[key >> 3] |= 1 << (key & 7);
+    } else {
+        heldKeys[key >> 3] &= ~(1 << (key & 7));
+    }
 }
 
 //
@@ -110,95 +217,130 @@ bool TargetKbd::isSpecial(uint8_t key) {
 bool TargetKbd::handleSpecial(uint8_t key, KeyAction a) {
     if (isSpecial(key)) {
         uint8_t ix = key & ~K_SPECIAL;
-        DPRINTLN("[TRGT] special " + String(key) + " @ " + String(ix));
+        TRACE(TRGT_SPECIAL, key, ix);
         if (ix < END_OF_COMBOS) {
-            handleCombo(SPECIALS[ix], a);
+            handleCombo(getSpecial(ix), a);
         } else if (ix > END_OF_COMBOS && a == RELEASE_KEY) {
-            handleMacro(SPECIALS[ix]);
+            queueMacro(key);
         }
         return true;
     }
     return false;
 }
 
-//
-void TargetKbd::handleCombo(uint8_t combo[], KeyAction a) {
+// Returns the combo or macro with given index from the specials table. Both
+// the table and the returned combo or macro reside in flash.
+const uint8_t *TargetKbd::getSpecial(uint8_t ix) {
+    return (const uint8_t *)pgm_read_ptr(&SPECIALS[ix]);
+}
+
+// Handles a combo, which resides in flash.
+void TargetKbd::handleCombo(const uint8_t combo[], KeyAction a) {
 
-    DPRINT("[TRGT] combo");
-    bool toggle = combo[0] == TOGGLE;
+    bool toggle = pgm_read_byte(&combo[0]) == TOGGLE;
     int ix = 0;
 
     if (toggle) {
-        DPRINTLN(" (toggle)");
+        TRACE(TRGT_COMBO_TOGGLE);
         a = a == PRESS_KEY ? FLIP_KEY : a;
         ix = 1;
     } else {
-        DPRINTLN();
+        TRACE(TRGT_COMBO);
     }
 
-    for (; combo[ix] != NA; ix++) {
+    int first = ix;
+
+    uint8_t k;
+
+    for (; (k = pgm_read_byte(&combo[ix])) != NA; ix++) {
         if (a != RELEASE_KEY) {
-            handleKey(combo[ix], a);
+            applyKey(k, a);
         }
     }
 
     if (!toggle && a == RELEASE_KEY) {
-        for (ix = ix - 1; ix >= 0 ; ix--) {
-            handleKey(combo[ix], a);
+        for (ix = ix - 1; ix >= first; ix--) {
+            applyKey(pgm_read_byte(&combo[ix]), a);
         }
     }
 }
 
-//
-void TargetKbd::handleMacro(uint8_t macro[]) {
-    DPRINTLN("[TRGT] macro");
-    uint8_t k;
-    for (int ix = 0; ; ix++) {
-        k = macro[ix];
-        if (k == NA) {
-            break;
-        }
-        handleKey(k, PRESS_KEY);
-        delay(MACRO_DELAY_PRESS);
-        handleKey(k, RELEASE_KEY);
-        delay(MACRO_DELAY_RELEASE);
+// Adds a macro or a key to be typed to the macro queue. Returns false if the
+// queue is full.
+bool TargetKbd::queueMacro(uint8_t key) {
+
+    if (macroCount == array_len(macroQueue)) {
+        TRACE(TRGT_MACRO_FULL, key);
+        return false;
+    }
+
+    if (macroCount == 0) {
+        macroDue = millis(); // start right away
+    }
+
+    TRACE(TRGT_MACRO_QUEUED, key);
+    macroQueue[(macroHead + macroCount) % array_len(macroQueue)] = key;
+    macroCount++;
+    return true;
+}
+
+// Returns the key for the current step of the macro at the head of the queue,
+// or NA if the macro is finished.
+uint8_t TargetKbd::getMacroStep() {
+
+    uint8_t key = macroQueue[macroHead];
+
+    if (isSpecial(key) && (key & ~K_SPECIAL) > END_OF_COMBOS) {
+        return pgm_read_byte(&getSpecial(key & ~K_SPECIAL)[macroStep]);
     }
+
+    // single key to type
+    return macroStep == 0 ? key : NA;
 }
 
 //
-bool TargetKbd::isValidKeyAddress(uint8_t key) {
-    return key < K_SPECIAL;
+bool TargetKbd::isMacroRunning() {
+    return macroCount > 0;
 }
 
+// Advances the macro player. This needs to be called regularly from the main
+// loop. Each call performs at most one key action, and returns right away if
+// the next step is not yet due.
+void TargetKbd::process() {
 
-//
-bool TargetKbd::isValidAxAy(uint8_t ax, uint8_t ay) {
-    if (ax >= array_len(kbdMatrix)) {
-        DPRINTLN("[TRGT] matrix AX out of bounds: " + String(ax));
-        return false;
+    if (macroCount == 0 || (long)(millis() - macroDue) < 0) {
+        return;
     }
-    if (ay > 7) {
-        DPRINTLN("[TRGT] matrix AY out of bounds: " + String(ay));
-        return false;
+
+    uint8_t k = getMacroStep();
+
+    if (k == NA) {
+        TRACE(TRGT_MACRO_DONE);
+        macroHead = (macroHead + 1) % array_len(macroQueue);
+        macroCount--;
+        macroStep = 0;
+        return;
     }
-    return true;
-}
 
-//
-void TargetKbd::setKeyState(uint8_t ax, uint8_t ay, bool on) {
-    if (isValidAxAy(ax, ay)) {
-        if (on) {
-            kbdMatrix[ax] = kbdMatrix[ax] | (1 << ay);
-        } else {
-            kbdMatrix[ax] = kbdMatrix[ax] & (~(1 << ay));
-        }
+    enter();
+
+    // The macro player holds its own references, so it does not interfere
+    // with keys held via handleKey.
+    if (macroKeyDown) {
+        applyKey(k, RELEASE_KEY);
+        macroKeyDown = false;
+        macroStep++;
+        macroDue = millis() + MACRO_DELAY_RELEASE;
+    } else {
+        applyKey(k, PRESS_KEY);
+        macroKeyDown = true;
+        macroDue = millis() + MACRO_DELAY_PRESS;
     }
+
+    leave();
 }
 
 //
-bool TargetKbd::getKeyState(uint8_t ax, uint8_t ay) {
-    if (isValidAxAy(ax, ay)) {
-        return (kbdMatrix[ax] & (1 << ay)) != 0;
-    }
-    return false;
+bool TargetKbd::isValidKeyAddress(uint8_t key) {
+    return key < K_SPECIAL;
 }
@@ -26,29 +26,69 @@
 class TargetKbd {
 
 private:
-    MT88xx mt88xx;
-    // This bit matrix represents the current state of the target keyboard.
-    // A key is pressed when its corresponding bit is 0.
+    MT88xxBus mt88xx;
+    // This bit matrix is a shadow of the current switch states in the MT88xx,
+    // one byte per AX line, one bit per AY line. A switch is closed, i.e. the
+    // key pressed, when its corresponding bit is 1.
     uint8_t kbdMatrix[16];
+    // The state we want the target keyboard to be in, same layout as above.
+    // Changes are committed to the MT88xx by diffing against kbdMatrix, so
+    // that only switches that actually change get strobed.
+    uint8_t desiredMatrix[16];
+    // Switches flipped by FLIP_KEY or toggle combos. A toggled switch stays
+    // closed regardless of its reference count.
+    uint8_t toggleMatrix[16];
+    // Number of holders of each switch, indexed by key address. Keys and
+    // combos that share a switch, e.g. a modifier, each hold a reference, so
+    // the switch only opens once the last holder lets go.
+    uint8_t keyRefs[128];
+    // Bit set of keys passed to handleKey that are currently pressed, so that
+    // repeated presses or releases of a key don't skew the reference counts.
+    uint8_t heldKeys[32];
+
+    // Queue of keys to be typed by the macro player. An entry is either a
+    // macro, i.e. a special key referencing a macro, or a plain key or combo
+    // that is typed once.
+    uint8_t macroQueue[MACRO_QUEUE_SIZE];
+    uint8_t macroHead = 0;
+    uint8_t macroCount = 0;
+    uint8_t macroStep = 0;          // index of current key within macro
+    bool macroKeyDown = false;      // whether current key is pressed
+    unsigned long macroDue = 0;     // time in ms when next step is due
+
+    // Set while the main loop changes the keyboard state, so that key events
+    // from ISRs get deferred, see tryHandleKey.
+    volatile bool busy = false;
+
+    void enter();
+    void leave();
 
     void clearKeyboardMatrix();
+    void clearMacroQueue();
     bool isSpecial(uint8_t key);
     bool isValidKeyAddress(uint8_t key);
-    bool isValidAxAy(uint8_t ax, uint8_t ay);
-    void setKeyState(uint8_t ax, uint8_t ay, bool on);
-    bool getKeyState(uint8_t ax, uint8_t ay);
+    bool isHeld(uint8_t key);
+    void setHeld(uint8_t key, bool held);
+    void updateDesired(uint8_t key);
+    void commit();
+    void applyKey(uint8_t k, KeyAction a);
     bool handleSpecial(uint8_t key, KeyAction a);
-    void handleCombo(uint8_t combo[], KeyAction a);
-    void handleMacro(uint8_t macro[]);
+    void handleCombo(const uint8_t combo[], KeyAction a);
+    const uint8_t *getSpecial(uint8_t ix);
+    bool queueMacro(uint8_t key);
+    uint8_t getMacroStep();
 
 public:
     TargetKbd();
     void reset();
+    void process();
+    bool isMacroRunning();
     void typeKey(uint8_t key);
     void flipKey(uint8_t key);
     void pressKey(uint8_t key);
     void releaseKey(uint8_t key);
     void handleKey(uint8_t k, KeyAction a);
+    bool tryHandleKey(uint8_t k, KeyAction a);
 };
 
 #endif
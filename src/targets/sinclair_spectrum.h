@@ -21,6 +21,10 @@
     This header file contains all definitions needed for the Sinclair ZX Spectrum
     target. If you want to define your own target, you can start with below
     definitions and adapt as needed.
+
+    All tables, i.e. combos, macros, the specials table, and the key map, are
+    placed in flash via `PROGMEM`, so that they don't take up any RAM. Make
+    sure to keep that in your own target.
 */
 
 /* --- key addresses in target keyboard matrix --------------------------------
@@ -151,25 +155,25 @@ enum SPECIALS {
     Note that it is required to terminate each combo with `NA`! Failure to do
     so will result in crashes.
  */
-static const uint8_t combo_period[]       = {K_SYMBOL, K_M, NA};
-static const uint8_t combo_comma[]        = {K_SYMBOL, K_N, NA};
-static const uint8_t combo_semicolon[]    = {K_SYMBOL, K_O, NA};
-static const uint8_t combo_slash[]        = {K_SYMBOL, K_V, NA};
-static const uint8_t combo_asterisk[]     = {K_SYMBOL, K_B, NA};
-static const uint8_t combo_plus[]         = {K_SYMBOL, K_K, NA};
-static const uint8_t combo_minus[]        = {K_SYMBOL, K_J, NA};
-static const uint8_t combo_quote[]        = {K_SYMBOL, K_7, NA};
-static const uint8_t combo_double_quote[] = {K_SYMBOL, K_P, NA};
-static const uint8_t combo_equal[]        = {K_SYMBOL, K_L, NA};
-static const uint8_t combo_underscore[]   = {K_SYMBOL, K_0, NA};
-static const uint8_t combo_delete[]       = {K_CAPS, K_0, NA};
-static const uint8_t combo_up[]           = {K_CAPS, K_7, NA};
-static const uint8_t combo_down[]         = {K_CAPS, K_6, NA};
-static const uint8_t combo_left[]         = {K_CAPS, K_5, NA};
-static const uint8_t combo_right[]        = {K_CAPS, K_8, NA};
-static const uint8_t combo_extended[]     = {K_SYMBOL, K_CAPS, NA};
+static const uint8_t combo_period[]       PROGMEM = {K_SYMBOL, K_M, NA};
+static const uint8_t combo_comma[]        PROGMEM = {K_SYMBOL, K_N, NA};
+static const uint8_t combo_semicolon[]    PROGMEM = {K_SYMBOL, K_O, NA};
+static const uint8_t combo_slash[]        PROGMEM = {K_SYMBOL, K_V, NA};
+static const uint8_t combo_asterisk[]     PROGMEM = {K_SYMBOL, K_B, NA};
+static const uint8_t combo_plus[]         PROGMEM = {K_SYMBOL, K_K, NA};
+static const uint8_t combo_minus[]        PROGMEM = {K_SYMBOL, K_J, NA};
+static const uint8_t combo_quote[]        PROGMEM = {K_SYMBOL, K_7, NA};
+static const uint8_t combo_double_quote[] PROGMEM = {K_SYMBOL, K_P, NA};
+static const uint8_t combo_equal[]        PROGMEM = {K_SYMBOL, K_L, NA};
+static const uint8_t combo_underscore[]   PROGMEM = {K_SYMBOL, K_0, NA};
+static const uint8_t combo_delete[]       PROGMEM = {K_CAPS, K_0, NA};
+static const uint8_t combo_up[]           PROGMEM = {K_CAPS, K_7, NA};
+static const uint8_t combo_down[]         PROGMEM = {K_CAPS, K_6, NA};
+static const uint8_t combo_left[]         PROGMEM = {K_CAPS, K_5, NA};
+static const uint8_t combo_right[]        PROGMEM = {K_CAPS, K_8, NA};
+static const uint8_t combo_extended[]     PROGMEM = {K_SYMBOL, K_CAPS, NA};
 // when the first element is `TOGGLE`, the combo is handled as a toggle key
-static const uint8_t combo_caps_lock[]    = {TOGGLE, K_CAPS, NA};
+static const uint8_t combo_caps_lock[]    PROGMEM = {TOGGLE, K_CAPS, NA};
 
 /* --- macro definitions ------------------------------------------------------
 
@@ -181,7 +185,7 @@ static const uint8_t combo_caps_lock[]    = {TOGGLE, K_CAPS, NA};
     Note that it is required to terminate each macro with `NA`! Failure to do
     so will result in crashes.
  */
-static const uint8_t macro_format_serial[] = {
+static const uint8_t macro_format_serial[] PROGMEM = {
     SK(COMBO_EXTENDED), SK(COMBO_UNDERSCORE),   // FORMAT
     SK(COMBO_DOUBLE_QUOTE),                     // "
     K_B,                                        // b
@@ -191,7 +195,7 @@ static const uint8_t macro_format_serial[] = {
     NA
 };
 
-static const uint8_t macro_load_serial[] = {
+static const uint8_t macro_load_serial[] PROGMEM = {
     K_J,                                        // LOAD
     SK(COMBO_ASTERISK),                         // *
     SK(COMBO_DOUBLE_QUOTE),                     // "
@@ -205,7 +209,7 @@ static const uint8_t macro_load_serial[] = {
     This table aggregates all combos & macros that should be used. The order
     needs to exactly follow the `SPECIALS` enumeration above.
  */
-static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
+static const uint8_t* const SPECIALS[END_OF_SPECIALS] PROGMEM = {
     combo_period,
     combo_comma,
     combo_semicolon,
@@ -242,7 +246,7 @@ static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
     special keys (1), i.e. combos & macros, the size of this table must not
     exceed 128.
  */
-static const uint8_t MAP_INPUT_TO_TARGET[] = {
+static constexpr uint8_t MAP_INPUT_TO_TARGET[] PROGMEM = {
     NA,                 // KEY_RESERVED
     NA,                 // KEY_ESC
     K_1,                // KEY_1
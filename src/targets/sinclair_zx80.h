@@ -52,18 +52,18 @@ enum SPECIALS {
 };
 
 // combo definitions
-static const uint8_t combo_home[]         = {K_SHIFT, K_9, NA};
-static const uint8_t combo_double_quote[] = {K_SHIFT, K_Y, NA};
-static const uint8_t combo_asterisk[]     = {K_SHIFT, K_P, NA};
-static const uint8_t combo_edit[]         = {K_SHIFT, K_NEWLINE, NA};
+static const uint8_t combo_home[]         PROGMEM = {K_SHIFT, K_9, NA};
+static const uint8_t combo_double_quote[] PROGMEM = {K_SHIFT, K_Y, NA};
+static const uint8_t combo_asterisk[]     PROGMEM = {K_SHIFT, K_P, NA};
+static const uint8_t combo_edit[]         PROGMEM = {K_SHIFT, K_NEWLINE, NA};
 
 // macro definitions
-static const uint8_t macro_load[] = { // LOAD ""
+static const uint8_t macro_load[] PROGMEM = { // LOAD ""
     K_W, SK(COMBO_DOUBLE_QUOTE), SK(COMBO_DOUBLE_QUOTE), NA
 };
 
 // specials table
-static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
+static const uint8_t* const SPECIALS[END_OF_SPECIALS] PROGMEM = {
     combo_left,
     combo_down,
     combo_up,
@@ -98,7 +98,7 @@ static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
     map for translating input key codes (see input_keycodes.h) to target key
     addresses
  */
-static const uint8_t MAP_INPUT_TO_TARGET[] = {
+static constexpr uint8_t MAP_INPUT_TO_TARGET[] PROGMEM = {
     NA,                 // KEY_RESERVED
     NA,                 // KEY_ESC
     K_1,                // KEY_1
@@ -53,19 +53,19 @@ enum SPECIALS {
 };
 
 // combo definitions
-static const uint8_t combo_edit[]         = {K_SHIFT, K_1, NA};
-static const uint8_t combo_graphics[]     = {K_SHIFT, K_9, NA};
-static const uint8_t combo_double_quote[] = {K_SHIFT, K_P, NA};
-static const uint8_t combo_function[]     = {K_SHIFT, K_NEWLINE, NA};
-static const uint8_t combo_asterisk[]     = {K_SHIFT, K_B, NA};
+static const uint8_t combo_edit[]         PROGMEM = {K_SHIFT, K_1, NA};
+static const uint8_t combo_graphics[]     PROGMEM = {K_SHIFT, K_9, NA};
+static const uint8_t combo_double_quote[] PROGMEM = {K_SHIFT, K_P, NA};
+static const uint8_t combo_function[]     PROGMEM = {K_SHIFT, K_NEWLINE, NA};
+static const uint8_t combo_asterisk[]     PROGMEM = {K_SHIFT, K_B, NA};
 
 // macro definitions
-static const uint8_t macro_load[] = { // LOAD ""
+static const uint8_t macro_load[] PROGMEM = { // LOAD ""
     K_J, SK(COMBO_DOUBLE_QUOTE), SK(COMBO_DOUBLE_QUOTE), NA
 };
 
 // specials table
-static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
+static const uint8_t* const SPECIALS[END_OF_SPECIALS] PROGMEM = {
     combo_edit,
     combo_left,
     combo_down,
@@ -101,7 +101,7 @@ static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
     map for translating input key codes (see input_keycodes.h) to target key
     addresses
  */
-static const uint8_t MAP_INPUT_TO_TARGET[] = {
+static constexpr uint8_t MAP_INPUT_TO_TARGET[] PROGMEM = {
     NA,                 // KEY_RESERVED
     NA,                 // KEY_ESC
     K_1,                // KEY_1
@@ -0,0 +1,101 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+#include "config.h"
+
+// only compiled in debug mode, to not take up RAM otherwise
+#if DEBUG == true
+
+#include "latency.h"
+#include "serialproto.h"
+#include "trace.h"
+#include "uart.h"
+
+static const uint8_t MASK = TRACE_BUFFER_SIZE - 1;
+
+Trace trace;
+
+// Adds a record to the buffer. Returns false if the buffer is full. Needs to
+// be called with interrupts disabled.
+bool Trace::push(uint8_t event, uint16_t a, uint16_t b, uint16_t c) {
+
+    uint8_t next = (head + 1) & MASK;
+    if (next == tail) {
+        return false;
+    }
+
+    TraceRecord *r = &records[head];
+    r->event = event;
+    r->stamp = Latency::now();
+    r->args[0] = a;
+    r->args[1] = b;
+    r->args[2] = c;
+    head = next;
+    return true;
+}
+
+//
+void Trace::record(uint8_t event, uint16_t a, uint16_t b, uint16_t c) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (dropped > 0 && push(TRACE_DROPPED, dropped, 0, 0)) {
+            dropped = 0;
+        }
+        if (dropped > 0 || !push(event, a, b, c)) {
+            if (dropped < 0xffff) {
+                dropped++;
+            }
+        }
+    }
+}
+
+// Sends as many records to the host as fit into the UART's transmit buffer.
+// This needs to be called regularly from the main loop.
+void Trace::drain() {
+
+    while (tail != head) {
+
+        uint8_t count = (head - tail) & MASK;
+        uint8_t room = uart.txFree();
+        if (room < 3 + TRACE_RECORD_SIZE) {
+            return;
+        }
+        room = (room - 3) / TRACE_RECORD_SIZE;
+        if (count > room) {
+            count = room;
+        }
+
+        uart.write(FRAME_ESCAPE);
+        uart.write(REPLY_TRACE);
+        uart.write(count * TRACE_RECORD_SIZE);
+
+        for (; count > 0; count--) {
+            TraceRecord *r = &records[tail];
+            uart.write(r->event);
+            uart.write(r->stamp & 0xff);
+            uart.write(r->stamp >> 8);
+            for (uint8_t ix = 0; ix < array_len(r->args); ix++) {
+                uart.write(r->args[ix] & 0xff);
+                uart.write(r->args[ix] >> 8);
+            }
+            tail = (tail + 1) & MASK;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef TRACE_h
+#define TRACE_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "trace_events.h"
+
+#if (TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) != 0
+#error "TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+// size of a record on the wire: event, time stamp, and three arguments
+static const uint8_t TRACE_RECORD_SIZE = 9;
+
+//
+struct TraceRecord {
+    uint8_t event;
+    uint16_t stamp;                 // Latency::now() when recorded
+    uint16_t args[3];
+};
+
+/*
+    Debug trace facility. Trace points record an event id from
+    trace_events.h, a time stamp, and up to three arguments into a ring
+    buffer in RAM. This takes a few µs, with no heap use and no waiting for
+    the UART, so tracing hardly changes the timing of what is being traced.
+    Recording is safe from ISRs.
+
+    The buffer is drained from the main loop into `REPLY_TRACE` frames, see
+    serialproto.h, but only as far as there is room in the UART's transmit
+    buffer, so draining never blocks either. Trace frames are sent in both
+    protocol versions. If the buffer is full, new records are dropped, and a
+    `TRACE_DROPPED` record with the number of lost records is added once
+    there is room again. util/trace.c renders the records as text.
+
+    Use the `TRACE` macro from config.h for trace points, so that they
+    vanish when not in debug mode.
+ */
+class Trace {
+
+private:
+    TraceRecord records[TRACE_BUFFER_SIZE];
+    volatile uint8_t head = 0;      // only written by record()
+    volatile uint8_t tail = 0;      // only written by drain()
+    uint16_t dropped = 0;
+
+    bool push(uint8_t event, uint16_t a, uint16_t b, uint16_t c);
+
+public:
+    void record(uint8_t event, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+    void drain();
+};
+
+extern Trace trace;
+
+#endif
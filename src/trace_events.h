@@ -0,0 +1,86 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Trace points of the firmware, see trace.h. Each entry gives the name of
+    the event, and the printf format with which the host renders it, with up
+    to three unsigned arguments. The format strings are only compiled into
+    the host side decoder (util/trace.c), never into the firmware, so they
+    cost no flash. This header is therefore plain C, and must not include
+    anything.
+
+    New events need to be added at the end, so that a decoder built from an
+    older version of this file can still read the existing ones.
+ */
+
+#ifndef TRACE_EVENTS_h
+#define TRACE_EVENTS_h
+
+#define TRACE_EVENTS(X) \
+    X(DROPPED,              "[TRCE] dropped %u records") \
+    X(MAIN_SERIAL,          "[MAIN] serial: {%u, %u}") \
+    X(MAIN_RESET,           "[MAIN] resetting") \
+    X(SCHD_START,           "[SCHD] starting, tick: %uus") \
+    X(SCHD_TOO_MANY,        "[SCHD] too many tasks") \
+    X(SCHD_TASK,            "[SCHD] task %u: max late %u ticks, max run %uus") \
+    X(SCHD_MISSES,          "[SCHD] task %u: misses %u") \
+    X(SER_STATS,            "[ SER] framing errors %u, overruns %u, overflows %u") \
+    X(SER_BAD_FRAMES,       "[ SER] bad frames %u") \
+    X(SER_BAD_LEAD,         "[ SER] dropping invalid lead byte: %u") \
+    X(SER_INCOMPLETE,       "[ SER] dropping incomplete frame") \
+    X(SER_BAD_CONTROL,      "[ SER] dropping invalid control frame") \
+    X(SER_VERSION,          "[ SER] protocol version %u") \
+    X(SER_BAUD_REVERT,      "[ SER] baud rate not confirmed, reverting") \
+    X(SER_RESET,            "[ SER] resetting") \
+    X(SER_ILLEGAL,          "[ SER] illegal make/break code: %u") \
+    X(SER_KEY,              "[ SER] action: %u, code: %u, key: %u") \
+    X(SER_JOY_MAP_START,    "[ SER] setting joystick") \
+    X(SER_JOY_MAP,          "[ SER] joystick setup %u") \
+    X(PS2_RESET,            "[PS/2] resetting") \
+    X(PS2_RESET_OK,         "[PS/2] reset OK") \
+    X(PS2_RESET_NG,         "[PS/2] reset NG") \
+    X(PS2_ATTACHED,         "[PS/2] keyboard attached") \
+    X(PS2_NOT_ATTACHED,     "[PS/2] not attached") \
+    X(PS2_KEY,              "[PS/2] code: 0x%04x, key: %u") \
+    X(PS2_FAST_KEY,         "[PS/2] fast lane code: 0x%04x, key: %u") \
+    X(PS2_RELEASE_HELD,     "[PS/2] codes lost, releasing held keys") \
+    X(PS2_STATS,            "[PS/2] overflows: %u, parity errors: %u, resends: %u") \
+    X(PS2_CMD_FAILED,       "[PS/2] command 0x%02x failed: %u") \
+    X(PS2_JOY_MAP_START,    "[PS/2] setting joystick map") \
+    X(PS2_JOY_MAP,          "[PS/2] joystick setup %u") \
+    X(JOY_RESET,            "[ JOY] resetting") \
+    X(JOY_PORT,             "[ JOY] port data: %u") \
+    X(JOY_MAP,              "[ JOY] mapping action %u to key %u") \
+    X(TRGT_UNASSIGNED,      "[TRGT] unassigned key") \
+    X(TRGT_INVALID_KEY,     "[TRGT] invalid key address: %u") \
+    X(TRGT_KEY,             "[TRGT] key: %u, action: %u, refs: %u") \
+    X(TRGT_SWITCH,          "[TRGT] ax: %u, ay: %u, data: %u") \
+    X(TRGT_SPECIAL,         "[TRGT] special %u @ %u") \
+    X(TRGT_COMBO,           "[TRGT] combo") \
+    X(TRGT_COMBO_TOGGLE,    "[TRGT] combo (toggle)") \
+    X(TRGT_MACRO_FULL,      "[TRGT] macro queue full, dropping %u") \
+    X(TRGT_MACRO_QUEUED,    "[TRGT] queueing macro %u") \
+    X(TRGT_MACRO_DONE,      "[TRGT] macro done") \
+    X(MT88XX_RESET,         "[88xx] resetting")
+
+#define TRACE_EVENT_ID(name, format) TRACE_##name,
+
+enum TraceEvent {
+    TRACE_EVENTS(TRACE_EVENT_ID)
+    TRACE_EVENT_COUNT
+};
+
+#endif
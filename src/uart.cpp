@@ -0,0 +1,202 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <util/atomic.h>
+
+#include "latency.h"
+#include "uart.h"
+
+static const uint8_t RX_MASK = UART_RX_BUFFER_SIZE - 1;
+static const uint8_t TX_MASK = UART_TX_BUFFER_SIZE - 1;
+
+// RX ring buffer; head is only written by the RX interrupt, tail only by the
+// consumer
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+static uint8_t rxBuffer[UART_RX_BUFFER_SIZE];
+// arrival time of the oldest byte in the RX buffer, or of the last one if
+// the buffer is empty
+static volatile uint16_t rxStamp = 0;
+
+// TX ring buffer; head is only written by the producer, tail only by the
+// data register empty interrupt
+static volatile uint8_t txHead = 0;
+static volatile uint8_t txTail = 0;
+static uint8_t txBuffer[UART_TX_BUFFER_SIZE];
+static volatile bool txWritten = false;
+
+static volatile UartStats stats;
+
+Uart uart;
+
+//
+ISR(USART_RX_vect) {
+
+    // status needs to be read before data
+    uint8_t status = UCSR0A;
+    uint8_t b = UDR0;
+
+    if (status & (1 << FE0)) {
+        stats.framingErrors++;
+        return;
+    }
+
+    if (status & (1 << DOR0)) {
+        stats.dataOverruns++;
+    }
+
+    uint8_t next = (rxHead + 1) & RX_MASK;
+    if (next == rxTail) {
+        stats.rxOverflows++;
+        return;
+    }
+
+    if (rxHead == rxTail) {
+        rxStamp = Latency::now();
+    }
+
+    rxBuffer[rxHead] = b;
+    rxHead = next;
+}
+
+// Sends next byte from TX buffer, called by data register empty interrupt.
+static void txNext() {
+
+    if (txHead == txTail) {
+        UCSR0B &= ~(1 << UDRIE0);
+        return;
+    }
+
+    UDR0 = txBuffer[txTail];
+    txTail = (txTail + 1) & TX_MASK;
+    // clear transmit complete flag by writing 1, for flush()
+    UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+}
+
+//
+ISR(USART_UDRE_vect) {
+    txNext();
+}
+
+// Sets up USART0 for 8N1 at given baud rate, using double speed mode.
+void Uart::begin(unsigned long baud) {
+
+    uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        UBRR0H = ubrr >> 8;
+        UBRR0L = ubrr & 0xff;
+        UCSR0A = (1 << U2X0);
+        UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+        UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
+        rxHead = rxTail = 0;
+        txHead = txTail = 0;
+        txWritten = false;
+    }
+}
+
+//
+uint8_t Uart::available() {
+    return (rxHead - rxTail) & RX_MASK;
+}
+
+//
+int16_t Uart::peek() {
+    if (rxHead == rxTail) {
+        return -1;
+    }
+    return rxBuffer[rxTail];
+}
+
+//
+int16_t Uart::read() {
+    uint8_t t = rxTail;
+    if (rxHead == t) {
+        return -1;
+    }
+    uint8_t b = rxBuffer[t];
+    rxTail = (t + 1) & RX_MASK;
+    return b;
+}
+
+// Returns the time at which the oldest byte still in the RX buffer was
+// received, as given by Latency::now(). Bytes received while the buffer
+// already held data don't get a time stamp of their own, so for them, this
+// is the arrival time of the first byte of that burst.
+uint16_t Uart::getRxStamp() {
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = rxStamp;
+    }
+    return t;
+}
+
+//
+uint8_t Uart::txFree() {
+    return (txTail - txHead - 1) & TX_MASK;
+}
+
+// Queues a byte for sending. This only blocks when the TX buffer is full.
+size_t Uart::write(uint8_t b) {
+
+    uint8_t next = (txHead + 1) & TX_MASK;
+
+    while (next == txTail) {
+        // If interrupts are disabled, e.g. when called from an ISR, the UDRE
+        // interrupt can't drain the buffer, so we need to do that ourselves.
+        if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0))) {
+            txNext();
+        }
+    }
+
+    txBuffer[txHead] = b;
+    txHead = next;
+    txWritten = true;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        UCSR0B |= (1 << UDRIE0);
+    }
+    return 1;
+}
+
+// Waits until all queued bytes have been sent.
+void Uart::flush() {
+    if (!txWritten) {
+        return;
+    }
+    while (txHead != txTail || !(UCSR0A & (1 << TXC0))) {
+        if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0))) {
+            txNext();
+        }
+    }
+}
+
+//
+void Uart::getStats(UartStats *s) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        s->framingErrors = stats.framingErrors;
+        s->dataOverruns = stats.dataOverruns;
+        s->rxOverflows = stats.rxOverflows;
+    }
+}
+
+//
+void Uart::resetStats() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        stats.framingErrors = 0;
+        stats.dataOverruns = 0;
+        stats.rxOverflows = 0;
+    }
+}
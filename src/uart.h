@@ -0,0 +1,65 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef UART_h
+#define UART_h
+
+#include <Arduino.h>
+
+#include "config.h"
+
+#if (UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) != 0
+#error "UART_RX_BUFFER_SIZE must be a power of two"
+#endif
+
+#if (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) != 0
+#error "UART_TX_BUFFER_SIZE must be a power of two"
+#endif
+
+//
+struct UartStats {
+    uint16_t framingErrors;     // bytes received with bad stop bit
+    uint16_t dataOverruns;      // bytes lost in hardware before RX interrupt
+    uint16_t rxOverflows;       // bytes dropped because RX buffer was full
+};
+
+/*
+    Interrupt driven driver for USART0, replacing the Arduino HardwareSerial.
+    Received bytes are placed into a single producer/single consumer ring
+    buffer by the RX interrupt, so no locking is needed for reading. Sending
+    is buffered as well, and only blocks when the TX buffer is full. Since
+    this driver owns the USART interrupt vectors, `Serial` must not be used
+    anywhere in the sketch.
+ */
+class Uart : public Print {
+
+public:
+    void begin(unsigned long baud);
+    uint8_t available();
+    int16_t peek();
+    int16_t read();
+    uint16_t getRxStamp();
+    uint8_t txFree();
+    void flush();
+    void getStats(UartStats *s);
+    void resetStats();
+    virtual size_t write(uint8_t b);
+    using Print::write;
+};
+
+extern Uart uart;
+
+#endif
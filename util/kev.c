@@ -18,10 +18,22 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <linux/input.h>
+#include <linux/serial.h>
 #include <string.h>
 #include <stdio.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <termios.h>
+#include <time.h>
 
 // for window focus
 #include <locale.h>
@@ -33,6 +45,10 @@
 
 // logging
 #include "log.h"
+#include "trace.h"
+
+// session recordings
+#include "rec.h"
 
 //
 #define IMAGE_WINDOW_NAME "Spectratur"
@@ -62,11 +78,201 @@ static const char *const keyActionTypes[3] = {
 static const int BREAK = 0;
 static const int MAKE = 1;
 
+// control commands
+static const char CMD_HELLO = '?';
+static const char CMD_RESET = '!';
+static const char CMD_BAUD  = 'b';
+static const char CMD_HISTOGRAM = 'h';
+static const char CMD_PING = 'p';
+
+// protocol version 2
+static const char FRAME_ESCAPE = 0;
+static const char FRAME_V2_MAKE = 0x80;
+static const int PROTOCOL_VERSION = 2;
+
+// types of binary frames from adapter
+static const char REPLY_CREDITS = 'c';
+static const char REPLY_HISTOGRAM = 'h';
+static const char REPLY_TRACE = 't';
+static const char REPLY_PING = 'p';
+
+// input sources of latency histograms, in order of adapter's reply
+static const char *const latencySources[] = {"serial", "PS/2", "joystick"};
+
+#define ADAPTER_NAME "spectratur"
+#define LINE_BUF_SIZE 256
+#define TX_QUEUE_SIZE 4096
+#define REPLY_TIMEOUT 1500 // ms
+#define HELLO_RETRIES 3
+#define BENCH_SAMPLES 65536
+#define MAX_EVENT_SOURCES 16
+#define EVENT_BATCH 64 // events per read
+#define KEY_FRAME_SIZE 64 // bytes sent per SYN_REPORT at most
+#define LOW_LATENCY_PRIORITY 50 // SCHED_FIFO
+
+// long options without short form
+enum {
+    OPT_BENCH = 256,
+    OPT_SYNC_FOCUS,
+    OPT_LOW_LATENCY,
+    OPT_PING,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_SPEED,
+    OPT_FROM
+};
+
+// baud rates supported by adapter, index is code for baud command
+static const struct {
+    long rate;
+    speed_t speed;
+} baudRates[] = {
+    {115200, B115200},
+    {500000, B500000},
+    {1000000, B1000000}
+};
+
+// protocol version in use
+int protocolVersion = 1;
+
+// set once latency histograms have been received
+volatile int histogramReceived = 0;
+
+// argument of last ping reply from adapter
+volatile int pingReply = -1;
+
 void cleanup();
 
 // file descriptors
 int fdSerialPort = -1;
-int fdKeyboard = -1;
+int fdWindowPipe[2] = {-1, -1};
+int fdQuitPipe[2] = {-1, -1};
+
+// --- shutdown ---------------------------------------------------------------
+
+/*
+    Cleaning up needs the send queue lock, so it can't be done from a signal
+    handler, or from another thread while the main loop may still be sending.
+    Instead, the main loop is asked to quit via a flag and a pipe, which it
+    watches along with the input devices, and then cleans up itself. Threads
+    started by kev block SIGINT, so that it interrupts the main loop.
+ */
+volatile sig_atomic_t quitRequested = 0;
+
+// async-signal-safe
+void request_quit() {
+    quitRequested = 1;
+    if (fdQuitPipe[1] >= 0) {
+        char c = 0;
+        ssize_t n = write(fdQuitPipe[1], &c, 1); // pipe full is fine
+        (void)n;
+    }
+}
+
+//
+void sigIntHandler(int sig) {
+    request_quit();
+}
+
+//
+void block_sigint() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+//
+void setup_signals_or_die() {
+
+    if (pipe(fdQuitPipe) != 0
+        || fcntl(fdQuitPipe[1], F_SETFL, O_NONBLOCK) != 0) {
+        log_fatal("cannot create pipe: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // no SA_RESTART, so that blocking calls in the main loop return
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigIntHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+}
+
+void add_event_source_or_die(int fd, const char* name, int window);
+
+// --- latency samples --------------------------------------------------------
+
+/*
+    For benchmarking, kev itself records latencies in ns, and prints them
+    with the same percentiles as the adapter's histograms. Samples beyond
+    BENCH_SAMPLES are counted, but not recorded.
+ */
+typedef struct {
+    long ns[BENCH_SAMPLES];
+    int count;
+    long dropped;
+} latency_samples;
+
+// set when running with --bench
+int benchmark = 0;
+
+// from kernel time stamp of key event to hand-over to serial link
+latency_samples forwardLatency;
+
+// clock used by kernel for time stamping key events
+clockid_t eventClock = CLOCK_REALTIME;
+
+// from sending ping to adapter to receiving its reply
+latency_samples roundTrip;
+
+//
+void add_sample(latency_samples* s, long ns) {
+    if (s->count < BENCH_SAMPLES) {
+        s->ns[s->count++] = ns;
+    } else {
+        s->dropped++;
+    }
+}
+
+// ns elapsed since given time stamp, taken with given clock
+long ns_since(clockid_t clk, const struct timeval* tv) {
+    struct timespec now;
+    clock_gettime(clk, &now);
+    return (now.tv_sec - tv->tv_sec) * 1000000000L
+        + now.tv_nsec - tv->tv_usec * 1000L;
+}
+
+//
+int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return x < y ? -1 : x > y;
+}
+
+//
+void print_samples(const char* name, latency_samples* s) {
+
+    printf("%-10s %8s %8s %8s %8s %8s %8s   (µs)\n",
+        "latency", "count", "min", "max", "p50", "p90", "p99");
+
+    if (s->count == 0) {
+        printf("%-10s %8d\n", name, 0);
+        return;
+    }
+
+    qsort(s->ns, s->count, sizeof(long), compare_long);
+    int n = s->count;
+    printf("%-10s %8d %8.1f %8.1f %8.1f %8.1f %8.1f\n", name, n,
+        s->ns[0] / 1000.0, s->ns[n - 1] / 1000.0,
+        s->ns[(n - 1) * 50 / 100] / 1000.0,
+        s->ns[(n - 1) * 90 / 100] / 1000.0,
+        s->ns[(n - 1) * 99 / 100] / 1000.0);
+
+    if (s->dropped > 0) {
+        printf("(%ld more samples not recorded)\n", s->dropped);
+    }
+}
 
 // --- serial communication ---------------------------------------------------
 
@@ -135,7 +341,7 @@ int open_serial_port_or_die(char* port) {
     }
 
     log_info("opening serial port %s", port);
-    int fd = open(port, O_RDWR | O_NOCTTY | O_SYNC);
+    int fd = open(port, O_RDWR | O_NOCTTY);
     if (fd < 0) {
         log_fatal("cannot open %s: %s", port, strerror(errno));
         exit(EXIT_FAILURE);
@@ -146,6 +352,589 @@ int open_serial_port_or_die(char* port) {
     return fd;
 }
 
+// --- low latency ------------------------------------------------------------
+
+/*
+    USB serial adapters hold back received data until their latency timer
+    expires, 16ms by default for FTDI chips, and the tty layer may defer
+    passing data on. In low latency mode, we shorten both where the driver
+    allows, keep kev's memory from being paged out, and run with real-time
+    priority. Threads started afterwards inherit the priority.
+ */
+
+// set when running with --low-latency
+int lowLatency = 0;
+
+//
+void set_serial_low_latency(int fd) {
+
+    struct serial_struct ser;
+    if (ioctl(fd, TIOCGSERIAL, &ser) != 0) {
+        log_warn("cannot get serial port settings: %s", strerror(errno));
+        return;
+    }
+
+    ser.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &ser) != 0) {
+        log_warn("cannot set serial port to low latency: %s", strerror(errno));
+    }
+}
+
+// set latency timer of USB serial adapter to 1ms, if its driver has one
+void set_latency_timer(const char* port) {
+
+    char path[PATH_MAX];
+    if (realpath(port, path) == NULL) {
+        return;
+    }
+
+    char* tty = strrchr(path, '/') + 1;
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file),
+        "/sys/bus/usb-serial/devices/%s/latency_timer", tty);
+
+    FILE* f = fopen(file, "w");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            log_debug("%s has no latency timer", tty);
+        } else {
+            log_warn("cannot set latency timer of %s: %s", tty, strerror(errno));
+        }
+        return;
+    }
+
+    fputs("1", f);
+    if (fclose(f) != 0) {
+        log_warn("cannot set latency timer of %s: %s", tty, strerror(errno));
+    } else {
+        log_info("set latency timer of %s to 1ms", tty);
+    }
+}
+
+//
+void set_low_latency(int fd, const char* port) {
+
+    set_serial_low_latency(fd);
+    set_latency_timer(port);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        log_warn("cannot lock memory: %s", strerror(errno));
+    }
+
+    struct sched_param param = {.sched_priority = LOW_LATENCY_PRIORITY};
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        log_warn("cannot switch to real-time scheduling: %s", strerror(err));
+    }
+}
+
+// --- flow control -----------------------------------------------------------
+
+/*
+    With protocol version 2, the adapter grants us credits for sending. We
+    never send more bytes than we have credits for. Anything that can't be
+    sent right away is kept in a bounded queue, and sent as new credits come
+    in. When the queue is full, senders block.
+ */
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    unsigned char buf[TX_QUEUE_SIZE];
+    int head;
+    int count;
+    int credits;
+    int flowControl;
+    int failed; // serial link broken, nothing gets sent anymore
+} txq = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// mark serial link as broken, wake up blocked senders, and have the main loop
+// quit; caller needs to hold lock
+void fail_link_locked() {
+    log_error("error writing to serial: %s", strerror(errno));
+    txq.failed = 1;
+    txq.count = 0;
+    pthread_cond_broadcast(&txq.changed);
+    request_quit();
+}
+
+// send as much of queue as credits allow; caller needs to hold lock
+void pump_locked(int fd) {
+
+    while (txq.count > 0 && txq.credits > 0) {
+
+        int len = txq.count < txq.credits ? txq.count : txq.credits;
+        if (txq.head + len > TX_QUEUE_SIZE) {
+            len = TX_QUEUE_SIZE - txq.head;
+        }
+
+        ssize_t n = write(fd, txq.buf + txq.head, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail_link_locked();
+            return;
+        }
+
+        log_trace("sent %d bytes, credits left: %d", (int)n,
+            (int)(txq.credits - n));
+        txq.head = (txq.head + n) % TX_QUEUE_SIZE;
+        txq.count -= n;
+        txq.credits -= n;
+        pthread_cond_broadcast(&txq.changed);
+    }
+}
+
+// send data to adapter, observing flow control
+void link_send(int fd, const char* data, int len) {
+
+    pthread_mutex_lock(&txq.lock);
+
+    if (txq.failed) {
+        pthread_mutex_unlock(&txq.lock);
+        return;
+    }
+
+    if (!txq.flowControl) {
+        if (write(fd, data, len) != len) {
+            fail_link_locked();
+        }
+        pthread_mutex_unlock(&txq.lock);
+        return;
+    }
+
+    for (int ix = 0; ix < len && !txq.failed; ix++) {
+        while (txq.count == TX_QUEUE_SIZE && !txq.failed) {
+            log_trace("send queue full, waiting");
+            pthread_cond_wait(&txq.changed, &txq.lock);
+        }
+        if (txq.failed) {
+            break;
+        }
+        txq.buf[(txq.head + txq.count) % TX_QUEUE_SIZE] = data[ix];
+        txq.count++;
+    }
+
+    pump_locked(fd);
+    pthread_mutex_unlock(&txq.lock);
+}
+
+//
+void add_credits(int fd, int credits) {
+    pthread_mutex_lock(&txq.lock);
+    txq.credits += credits;
+    log_trace("got %d credits, now: %d", credits, txq.credits);
+    pump_locked(fd);
+    pthread_mutex_unlock(&txq.lock);
+}
+
+// switch flow control on or off; resets credits
+void set_flow_control(int on) {
+    pthread_mutex_lock(&txq.lock);
+    txq.flowControl = on;
+    txq.credits = 0;
+    txq.head = 0;
+    txq.count = 0;
+    pthread_mutex_unlock(&txq.lock);
+}
+
+// wait until send queue is empty, or timeout in ms has passed
+void drain_send_queue(int timeout) {
+    for (; timeout > 0; timeout--) {
+        pthread_mutex_lock(&txq.lock);
+        int count = txq.count;
+        pthread_mutex_unlock(&txq.lock);
+        if (count == 0) {
+            return;
+        }
+        usleep(1000);
+    }
+    log_warn("could not send all queued data to adapter");
+}
+
+// --- reading from adapter ---------------------------------------------------
+
+/*
+    The adapter sends text lines, and with protocol version 2 also binary
+    frames. These start with a zero byte, followed by frame type, payload
+    length, and payload.
+ */
+typedef struct {
+    char line[LINE_BUF_SIZE];
+    int lineLen;
+    unsigned char frame[3 + 255];
+    int frameLen;
+} serial_reader;
+
+serial_reader reader;
+
+void print_histograms(unsigned char* payload, int len);
+
+//
+void handle_frame(int fd, unsigned char type, unsigned char* payload, int len) {
+    if (type == REPLY_CREDITS && len == 1) {
+        add_credits(fd, payload[0]);
+    } else if (type == REPLY_HISTOGRAM) {
+        print_histograms(payload, len);
+        histogramReceived = 1;
+    } else if (type == REPLY_TRACE) {
+        trace_print(payload, len);
+    } else if (type == REPLY_PING && len == 1) {
+        pingReply = payload[0];
+    } else {
+        log_trace("ignoring frame of type 0x%02x, length %d", type, len);
+    }
+}
+
+// feed received byte into reader; returns 1 when a complete line is available
+int reader_feed(serial_reader* r, unsigned char c, int fd) {
+
+    if (r->frameLen > 0 || c == FRAME_ESCAPE) {
+        r->frame[r->frameLen++] = c;
+        if (r->frameLen >= 3 && r->frameLen == 3 + r->frame[2]) {
+            handle_frame(fd, r->frame[1], r->frame + 3, r->frame[2]);
+            r->frameLen = 0;
+        }
+        return 0;
+    }
+
+    if (c == '\n') {
+        r->line[r->lineLen] = '\0';
+        r->lineLen = 0;
+        log_trace("received line: '%s'", r->line);
+        return 1;
+    }
+
+    if (c != '\r' && r->lineLen < LINE_BUF_SIZE - 1) {
+        r->line[r->lineLen++] = c;
+    }
+    return 0;
+}
+
+// read a line from serial port into buf, without line ending; returns length
+// of line, or -1 on timeout; binary frames received meanwhile are handled
+int read_line(int fd, char* buf, int size, int timeout) {
+
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    unsigned char c;
+
+    while (poll(&pfd, 1, timeout) > 0) {
+        if (read(fd, &c, 1) == 1 && reader_feed(&reader, c, fd)) {
+            strncpy(buf, reader.line, size - 1);
+            buf[size - 1] = '\0';
+            return strlen(buf);
+        }
+    }
+
+    return -1;
+}
+
+// wait until histograms have been received, or timeout in ms has passed;
+// returns 0 on timeout
+int wait_for_histograms(int fd, int timeout) {
+
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    unsigned char c;
+
+    while (!histogramReceived && poll(&pfd, 1, timeout) > 0) {
+        if (read(fd, &c, 1) == 1 && reader_feed(&reader, c, fd)) {
+            log_debug("adapter: %s", reader.line);
+        }
+    }
+
+    return histogramReceived;
+}
+
+// wait for reply to ping with given argument, or until timeout in ms has
+// passed; returns 0 on timeout
+int wait_for_ping(int fd, unsigned char arg, int timeout) {
+
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    unsigned char c;
+
+    while (pingReply != arg && poll(&pfd, 1, timeout) > 0) {
+        if (read(fd, &c, 1) == 1 && reader_feed(&reader, c, fd)) {
+            log_debug("adapter: %s", reader.line);
+        }
+    }
+
+    return pingReply == arg;
+}
+
+// read from adapter in the background, for receiving credits and logging
+// anything else the adapter sends
+void* read_serial_threaded(void* arg) {
+
+    int fd = *(int*)arg;
+    unsigned char buf[64];
+    block_sigint();
+
+    while (TRUE) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            log_error("error reading from serial: %s", strerror(errno));
+            return NULL;
+        }
+        for (int ix = 0; ix < n; ix++) {
+            if (reader_feed(&reader, buf[ix], fd)) {
+                log_debug("adapter: %s", reader.line);
+            }
+        }
+    }
+}
+
+//
+void start_serial_reader_or_die(int* fd) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, read_serial_threaded, fd) != 0) {
+        log_fatal("cannot start serial reader thread");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
+
+// --- adapter control --------------------------------------------------------
+
+//
+void send_command(char cmd, char arg, int fdSer) {
+
+    char sendBuf[3] = {FRAME_ESCAPE, cmd, arg};
+    int len = 3;
+    char* start = sendBuf;
+
+    if (protocolVersion == 1) {
+        start++;
+        len--;
+    }
+
+    log_debug("sending command '%c' (%d) to serial", cmd, arg);
+    link_send(fdSer, start, len);
+}
+
+// reset adapter to defaults, i.e. protocol version 1 at default baud rate;
+// like hello, this bypasses flow control, so it goes out even when we're out
+// of credits; anything still queued is dropped
+void reset_adapter(int fd) {
+    set_flow_control(0);
+    send_command(CMD_RESET, 0, fd);
+    tcdrain(fd);
+}
+
+// Sends hello with requested protocol version, and waits for reply. Returns
+// protocol version confirmed by adapter, or 0 if there was no reply. Adapters
+// that don't support version negotiation just reply with their name, which
+// means version 1.
+int say_hello(int fd, int version) {
+
+    char line[64];
+
+    // hello is exempt from flow control; adapter grants initial credits
+    // after replying
+    set_flow_control(0);
+
+    for (int try = 0; try < HELLO_RETRIES; try++) {
+        send_command(CMD_HELLO, version, fd);
+        // There may be other lines in the reply stream, e.g. from the start
+        // up of the adapter or debug messages, so we keep reading until we
+        // either see a reply for the requested version, or time out.
+        int v = 0;
+        while (read_line(fd, line, sizeof(line), REPLY_TIMEOUT) >= 0) {
+            if (strcmp(line, ADAPTER_NAME) == 0) {
+                v = 1;
+            } else if (strncmp(line, ADAPTER_NAME " ", 11) == 0) {
+                v = atoi(line + 11);
+            }
+            if (v == version) {
+                break;
+            }
+        }
+        if (v > 0) {
+            set_flow_control(v > 1);
+            return v;
+        }
+        log_debug("no reply to hello, retrying");
+    }
+
+    return 0;
+}
+
+// Negotiates protocol version and baud rate with adapter.
+void negotiate_or_die(int fd, int version, int baudCode) {
+
+    log_info("negotiating protocol version %d", version);
+    tcflush(fd, TCIOFLUSH);
+
+    protocolVersion = 1; // hello is always sent in version 1 format
+    int v = say_hello(fd, version);
+    if (v == 0) {
+        log_fatal("no reply from adapter");
+        exit(EXIT_FAILURE);
+    }
+    protocolVersion = v;
+    log_info("using protocol version %d", v);
+
+    if (baudCode == 0) {
+        return;
+    }
+
+    if (v < 2) {
+        log_warn("adapter does not support baud rate switching");
+        return;
+    }
+
+    char line[64];
+    send_command(CMD_BAUD, baudCode, fd);
+    if (read_line(fd, line, sizeof(line), REPLY_TIMEOUT) < 0
+        || strncmp(line, "baud ", 5) != 0
+        || atol(line + 5) != baudRates[baudCode].rate) {
+        log_fatal("adapter did not acknowledge baud rate switch");
+        exit(EXIT_FAILURE);
+    }
+
+    tcdrain(fd);
+    configure_port(fd, baudRates[baudCode].speed, 0);
+    set_blocking(fd, 0);
+    tcflush(fd, TCIOFLUSH);
+
+    // adapter reverts to defaults if we don't confirm the new baud rate
+    if (say_hello(fd, v) != v) {
+        log_fatal("no reply from adapter at %ld baud", baudRates[baudCode].rate);
+        exit(EXIT_FAILURE);
+    }
+    log_info("switched to %ld baud", baudRates[baudCode].rate);
+}
+
+// --- latency statistics -----------------------------------------------------
+
+/*
+    The adapter reports latency histograms as the length of a timer count in
+    µs, the number of buckets, and then per input source count, min & max in
+    timer counts (16 bit little endian), followed by one byte per bucket.
+    Bucket 0 holds latencies below 2 counts, bucket n > 0 those from 2^n up
+    to 2^(n+1) counts, the last bucket also everything above.
+ */
+
+// upper bound in timer counts of the bucket in which given percentile lies
+long percentile(unsigned char* buckets, int count, int max, int p) {
+
+    long total = 0;
+    for (int ix = 0; ix < count; ix++) {
+        total += buckets[ix];
+    }
+
+    long sum = 0;
+    for (int ix = 0; ix < count; ix++) {
+        sum += buckets[ix];
+        if (sum * 100 >= total * p) {
+            long bound = 2L << ix;
+            return ix == count - 1 || bound > max ? max : bound;
+        }
+    }
+
+    return max;
+}
+
+//
+void print_histograms(unsigned char* payload, int len) {
+
+    if (len < 2) {
+        log_error("invalid histogram reply");
+        return;
+    }
+
+    int unit = payload[0];
+    int buckets = payload[1];
+    int size = 6 + buckets;
+    unsigned char* p = payload + 2;
+
+    printf("%-10s %8s %8s %8s %8s %8s %8s   (µs, percentiles are upper bounds)\n",
+        "source", "count", "min", "max", "p50", "p90", "p99");
+
+    for (int s = 0; s < LEN(latencySources) && p + size <= payload + len;
+        s++, p += size) {
+
+        int count = p[0] | p[1] << 8;
+        int min = p[2] | p[3] << 8;
+        int max = p[4] | p[5] << 8;
+
+        if (count == 0) {
+            printf("%-10s %8d\n", latencySources[s], 0);
+            continue;
+        }
+
+        printf("%-10s %8d %8ld %8ld %8ld %8ld %8ld\n", latencySources[s],
+            count, (long)min * unit, (long)max * unit,
+            percentile(p + 6, buckets, max, 50) * unit,
+            percentile(p + 6, buckets, max, 90) * unit,
+            percentile(p + 6, buckets, max, 99) * unit);
+    }
+}
+
+// query adapter for latency histograms, print them, and reset them on the
+// adapter, so that the next query only covers new key events
+void query_histograms_or_die(int fd) {
+
+    if (protocolVersion < 2) {
+        log_fatal("adapter does not support latency statistics");
+        exit(EXIT_FAILURE);
+    }
+
+    send_command(CMD_HISTOGRAM, 1, fd);
+    if (!wait_for_histograms(fd, REPLY_TIMEOUT)) {
+        log_fatal("no latency statistics from adapter");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// ping adapter given number of times, one after the other, and print the
+// round trip times
+void ping_or_die(int fd, int count) {
+
+    if (protocolVersion < 2) {
+        log_fatal("adapter does not support ping");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int ix = 0; ix < count && !quitRequested; ix++) {
+
+        unsigned char arg = (unsigned char)ix;
+        struct timespec start, end;
+
+        pingReply = -1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        send_command(CMD_PING, arg, fd);
+
+        if (!wait_for_ping(fd, arg, REPLY_TIMEOUT)) {
+            if (quitRequested) {
+                break; // interrupted, print what we have
+            }
+            log_fatal("no reply to ping from adapter");
+            exit(EXIT_FAILURE);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        add_sample(&roundTrip, (end.tv_sec - start.tv_sec) * 1000000000L
+            + end.tv_nsec - start.tv_nsec);
+    }
+
+    print_samples("round trip", &roundTrip);
+}
+
+//
+int get_baud_code_or_die(const char* baud) {
+    long rate = atol(baud);
+    for (int ix = 0; ix < LEN(baudRates); ix++) {
+        if (baudRates[ix].rate == rate) {
+            return ix;
+        }
+    }
+    log_fatal("unsupported baud rate: %s, use 115200, 500000, or 1000000", baud);
+    exit(EXIT_FAILURE);
+}
+
 //
 void close_serial_port(int fd) {
     if (fd) {
@@ -154,25 +943,35 @@ void close_serial_port(int fd) {
     }
 }
 
-//
-void send_key_stroke(int typ, int code, int fdSer) {
+// encode key stroke for the adapter into buf, which needs room for two
+// bytes; returns number of bytes, or 0 if the key stroke is not passed on
+int encode_key_stroke(int typ, int code, char* buf) {
 
     if (typ < 0 || typ >= LEN(keyActionTypes)) {
-        return;
+        return 0;
     }
 
     log_debug("%s 0x%04x (%d)", keyActionTypes[typ], code, code);
 
     if (typ != MAKE && typ != BREAK) {
-        return;
+        return 0;
+    }
+
+    if (protocolVersion == 1) {
+        buf[0] = (char)typ;
+        buf[1] = (char)code;
+        log_debug("sending to serial: [0x%x, 0x%x]", buf[0], buf[1]);
+        return 2;
     }
 
-    char sendBuf[2];
-    sendBuf[0] = (char)typ;
-    sendBuf[1] = (char)code;
+    if (code <= 0 || code > 0x7f) { // can't be encoded
+        log_debug("discarding key code 0x%04x (%d)", code, code);
+        return 0;
+    }
 
-    log_debug("sending to serial: [0x%x, 0x%x]", sendBuf[0], sendBuf[1]);
-    write(fdSer, &sendBuf, 2);
+    buf[0] = (char)((typ == MAKE ? FRAME_V2_MAKE : 0) | code);
+    log_debug("sending to serial: [0x%x]", (unsigned char)buf[0]);
+    return 1;
 }
 
 // --- keyboard image window --------------------------------------------------
@@ -180,15 +979,34 @@ void send_key_stroke(int typ, int code, int fdSer) {
 //
 void window_destroy(void) {
     gtk_main_quit();
-    cleanup();
-    log_info("exiting");
-    exit(EXIT_SUCCESS);
+    request_quit();
 }
 
 // for filtering out auto repeat keys
 guint16 lastPressedKey = 0;
 Bool lastWasPressed = False;
 
+// Passes key event from image window on to the read & send loop, as an evdev
+// event followed by a SYN_REPORT, so that all key events go through the same
+// path. Writes of up to PIPE_BUF bytes are atomic, so the loop always reads
+// whole events.
+void forward_window_key(int typ, int code) {
+
+    struct input_event ev[2];
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_KEY;
+    ev[0].code = code;
+    ev[0].value = typ;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    gettimeofday(&ev[0].time, NULL); // for recording
+    ev[1].time = ev[0].time;
+
+    if (write(fdWindowPipe[1], ev, sizeof(ev)) != sizeof(ev)) {
+        log_error("error passing on window key event: %s", strerror(errno));
+    }
+}
+
 //
 // TODO: not sure why GDK scan codes are eight higher than kernel input event
 //       codes
@@ -198,7 +1016,7 @@ Bool lastWasPressed = False;
 gboolean key_pressed(GtkWidget* widget, GdkEventKey* evt, gpointer data) {
     guint16 code = evt->hardware_keycode - 8;
     if (!lastWasPressed || lastPressedKey != code) {
-        send_key_stroke(1, code, fdSerialPort);
+        forward_window_key(MAKE, code);
         lastPressedKey = code;
         lastWasPressed = True;
     } else {
@@ -209,7 +1027,7 @@ gboolean key_pressed(GtkWidget* widget, GdkEventKey* evt, gpointer data) {
 
 //
 gboolean key_released(GtkWidget* widget, GdkEventKey* evt, gpointer data) {
-    send_key_stroke(0, evt->hardware_keycode - 8, fdSerialPort);
+    forward_window_key(BREAK, evt->hardware_keycode - 8);
     lastWasPressed = False;
     return TRUE;
 }
@@ -223,6 +1041,8 @@ typedef struct {
 //
 void open_keyboard_window_threaded(thread_data* d) {
 
+    block_sigint();
+
     GtkWidget* window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), IMAGE_WINDOW_NAME);
 
@@ -245,6 +1065,15 @@ void open_keyboard_window_or_die(char* file, int listen) {
 
     gtk_init(NULL, NULL);
 
+    if (listen) {
+        if (pipe(fdWindowPipe) != 0) {
+            log_fatal("cannot create pipe for window key events: %s",
+                strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        add_event_source_or_die(fdWindowPipe[0], "image window", 1);
+    }
+
     char* name = "gtk-thread";
     GError* err = NULL;
     thread_data d;
@@ -399,6 +1228,80 @@ int is_in_focus(Display* d, const char* ownName, char* bufName, int size) {
         && strcmp(ownName, bufName) == 0;
 }
 
+/*
+    Checking the focus window takes several round trips to the X server, too
+    slow for doing it on every key event. Instead, a watcher thread listens
+    for changes of _NET_ACTIVE_WINDOW on the root window, and for focus
+    changes of the focus window, for window managers that don't maintain the
+    former. It then re-checks the focus and caches the result. The watcher
+    has the display connection to itself once started.
+ */
+
+// set while own window is in focus, maintained by focus watcher
+volatile int inFocus = 0;
+
+//
+void update_focus(Display* d, Window root) {
+
+    xerror = False;
+
+    Window w = get_focus_window(d);
+    if (w != None && w != PointerRoot) {
+        // selecting on root would replace our mask there
+        XSelectInput(d, w, w == root ?
+            PropertyChangeMask | FocusChangeMask : FocusChangeMask);
+    }
+
+    w = get_named_window(d, get_top_window(d, w));
+    int focus = get_window_name(d, w, bufName, sizeof(bufName))
+        && strcmp(ownWindowName, bufName) == 0;
+
+    if (focus != inFocus) {
+        log_debug(focus ? "in focus" : "not in focus");
+    }
+    inFocus = focus;
+}
+
+//
+void* watch_focus_threaded(void* arg) {
+
+    Display* d = (Display*)arg;
+    block_sigint();
+    Window root = DefaultRootWindow(d);
+    Atom activeWindow = XInternAtom(d, "_NET_ACTIVE_WINDOW", False);
+    XEvent ev;
+
+    while (TRUE) {
+        // re-check once for a burst of changes
+        int changed = 0;
+        do {
+            XNextEvent(d, &ev);
+            changed |= (ev.type == PropertyNotify
+                    && ev.xproperty.atom == activeWindow)
+                || ev.type == FocusIn || ev.type == FocusOut;
+        } while (XPending(d) > 0);
+
+        if (changed) {
+            update_focus(d, root);
+        }
+    }
+}
+
+//
+void start_focus_watcher_or_die(Display* d) {
+
+    Window root = DefaultRootWindow(d);
+    XSelectInput(d, root, PropertyChangeMask);
+    update_focus(d, root);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, watch_focus_threaded, d) != 0) {
+        log_fatal("cannot start focus watcher thread");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
+
 //
 void get_own_window_name_or_die(Display* d) {
     if (get_current_window_name(d, ownWindowName, sizeof(ownWindowName))) {
@@ -426,8 +1329,45 @@ Display* open_display_or_die() {
 
 // --- keyboard ---------------------------------------------------------------
 
+/*
+    Key events come from any number of evdev devices, e.g. keyboards and game
+    controllers, and from the image window via a pipe. All of them are read
+    in one epoll loop. The kernel groups events into frames ended by a
+    SYN_REPORT, e.g. all keys of a chord. We collect the encoded key strokes
+    of a frame, and send them with a single write.
+ */
+typedef struct {
+    int fd;
+    const char* name;
+    int window; // image window, only gets key events while in focus
+    char frame[KEY_FRAME_SIZE];
+    int frameLen;
+    struct input_event keys[KEY_FRAME_SIZE]; // in frame, for recording
+    int keyCount;
+} event_source;
+
+event_source sources[MAX_EVENT_SOURCES];
+int sourceCount = 0;
+
+//
+void add_event_source_or_die(int fd, const char* name, int window) {
+
+    if (sourceCount == MAX_EVENT_SOURCES) {
+        log_fatal("too many input devices, at most %d are supported",
+            MAX_EVENT_SOURCES);
+        exit(EXIT_FAILURE);
+    }
+
+    event_source* src = &sources[sourceCount++];
+    memset(src, 0, sizeof(*src));
+    src->fd = fd;
+    src->name = name;
+    src->window = window;
+}
+
+//
 int open_keyboard_or_die(char* kbd) {
-    int fd = open(kbd, O_RDONLY);
+    int fd = open(kbd, O_RDONLY | O_NONBLOCK);
     if (fd < 0) {
         log_fatal("cannot open keyboard device %s: %s. try with sudo?",
             kbd, strerror(errno));
@@ -436,49 +1376,261 @@ int open_keyboard_or_die(char* kbd) {
     return fd;
 }
 
+// have the kernel time stamp key events with the monotonic clock, so that
+// forwarding latency isn't skewed by time adjustments
+void set_event_clock(int fd) {
+    int clk = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clk) == 0) {
+        eventClock = CLOCK_MONOTONIC;
+    } else {
+        log_warn("cannot switch event clock, using real time");
+    }
+}
+
 //
-void close_keyboard(int fd) {
-    if (fd) {
-        log_info("closing keyboard");
-        close(fd);
+void close_event_sources() {
+    for (int ix = 0; ix < sourceCount; ix++) {
+        if (sources[ix].fd >= 0) {
+            log_info("closing %s", sources[ix].name);
+            close(sources[ix].fd);
+            sources[ix].fd = -1;
+        }
     }
 }
 
-// --- read & send loop -------------------------------------------------------
+// --- recording & replay -----------------------------------------------------
 
-// read key strokes & send to serial; NULL display implies to always read key events
-void read_kbd_and_send(Display* d, int fdKbd, int fdSer) {
+/*
+    With --record, all key events sent to the adapter are written to a file,
+    with the kernel's time stamps, see rec.c. With --replay, such a file is
+    sent to the adapter instead of live key events. The time of each frame
+    is computed from the start of the replay, and we sleep until then, so
+    that timing errors don't add up. At speed 0, frames are sent as fast as
+    the adapter grants credits.
+ */
 
-    log_info("starting to read from keyboard");
+// set when running with --record
+int recording = 0;
+rec_writer recorder;
 
-    struct input_event ev;
-    ssize_t n;
+//
+void record_keys(struct input_event* keys, int count) {
+    for (int ix = 0; ix < count && recording; ix++) {
+        unsigned long long stamp =
+            keys[ix].time.tv_sec * 1000000ULL + keys[ix].time.tv_usec;
+        if (!rec_add(&recorder, stamp, keys[ix].code, keys[ix].value == MAKE,
+            ix == count - 1)) {
+            log_error("stopping recording");
+            rec_close(&recorder);
+            recording = 0;
+        }
+    }
+}
 
-    while (TRUE) {
+// sleep until given time in ns after start
+void sleep_until(const struct timespec* start, unsigned long long ns) {
+
+    struct timespec t = *start;
+    t.tv_sec += ns / 1000000000ULL;
+    t.tv_nsec += ns % 1000000000ULL;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+    }
 
-        n = read(fdKbd, &ev, sizeof ev);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR
+        && !quitRequested);
+}
+
+// replay recording, starting at given time in s into it, with given speed
+// factor, or as fast as credits allow if speed is 0
+void replay_or_die(const char* file, double from, double speed, int fdSer) {
 
-        if (d != NULL &&
-            !is_in_focus(d, ownWindowName, bufName, sizeof(ownWindowName))) {
-            log_trace("not in focus");
+    rec_reader r;
+    unsigned long long offset = (unsigned long long)(from * 1000000);
+
+    if (!rec_open(&r, file) || !rec_seek(&r, offset)) {
+        log_fatal("cannot replay %s", file);
+        exit(EXIT_FAILURE);
+    }
+
+    log_info("replaying %s", file);
+
+    char frame[KEY_FRAME_SIZE];
+    int len = 0;
+    long frames = 0;
+    rec_event ev;
+    int res;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!quitRequested && (res = rec_next(&r, &ev)) > 0) {
+
+        if (ev.time < offset) {
             continue;
         }
 
-        if (n == (ssize_t)-1) {
+        if (len == 0 && speed > 0) {
+            sleep_until(&start, (ev.time - offset) * 1000 / speed);
+        }
+
+        if (len > KEY_FRAME_SIZE - 2) {
+            link_send(fdSer, frame, len);
+            len = 0;
+        }
+        len += encode_key_stroke(ev.make ? MAKE : BREAK, ev.code, frame + len);
+
+        if (ev.frameEnd) {
+            link_send(fdSer, frame, len);
+            len = 0;
+            frames++;
+        }
+    }
+
+    if (len > 0) {
+        link_send(fdSer, frame, len);
+    }
+
+    rec_close_reader(&r);
+
+    if (res < 0) {
+        log_fatal("cannot replay %s", file);
+        exit(EXIT_FAILURE);
+    }
+
+    log_info("replayed %ld frames", frames);
+}
+
+// --- read & send loop -------------------------------------------------------
+
+// send key strokes collected for a frame, if we're in focus; NULL display
+// implies to always send; with syncFocus set, focus is checked via display,
+// otherwise the focus watcher's result is used; returns 1 if sent
+int send_frame(event_source* src, Display* d, int syncFocus, int fdSer) {
+
+    int len = src->frameLen;
+    int keyCount = src->keyCount;
+    src->frameLen = 0;
+    src->keyCount = 0;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (!src->window && d != NULL && (syncFocus ?
+        !is_in_focus(d, ownWindowName, bufName, sizeof(bufName)) :
+        !inFocus)) {
+        log_trace("not in focus");
+        return 0;
+    }
+
+    link_send(fdSer, src->frame, len);
+    record_keys(src->keys, keyCount);
+    return 1;
+}
+
+// handle events read from a source
+void handle_events(event_source* src, struct input_event* ev, int count,
+    Display* d, int syncFocus, int fdSer) {
+
+    for (int ix = 0; ix < count; ix++) {
+
+        if (ev[ix].type == EV_KEY) {
+            if (src->frameLen > KEY_FRAME_SIZE - 2) {
+                send_frame(src, d, syncFocus, fdSer);
+            }
+            int len = encode_key_stroke(
+                ev[ix].value, ev[ix].code, src->frame + src->frameLen);
+            if (len > 0) {
+                src->frameLen += len;
+                src->keys[src->keyCount++] = ev[ix];
+            }
+
+        } else if (ev[ix].type == EV_SYN && ev[ix].code == SYN_REPORT) {
+            if (send_frame(src, d, syncFocus, fdSer)
+                && benchmark && !src->window) {
+                add_sample(&forwardLatency, ns_since(eventClock, &ev[ix].time));
+            }
+
+        } else if (ev[ix].type == EV_SYN && ev[ix].code == SYN_DROPPED) {
+            log_warn("%s: events dropped by kernel", src->name);
+        }
+    }
+}
+
+// read key events from all sources & send to serial; returns when asked to
+// quit, when there are no sources left, or on error
+void read_events_and_send(Display* d, int syncFocus, int fdSer) {
+
+    log_info("starting to read key events");
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        return;
+    }
+
+    for (int ix = 0; ix < sourceCount; ix++) {
+        struct epoll_event ee = {.events = EPOLLIN, .data.ptr = &sources[ix]};
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, sources[ix].fd, &ee) != 0) {
+            close(ep);
+            return;
+        }
+    }
+
+    // NULL source stands for quit pipe
+    struct epoll_event quit = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, fdQuitPipe[0], &quit) != 0) {
+        close(ep);
+        return;
+    }
+
+    struct epoll_event ready[MAX_EVENT_SOURCES + 1];
+    struct input_event ev[EVENT_BATCH];
+    int active = sourceCount;
+
+    while (active > 0 && !quitRequested) {
+
+        int n = epoll_wait(ep, ready, LEN(ready), -1);
+        if (n < 0) {
             if (errno == EINTR) {
                 continue;
-            } else {
-                break;
             }
-        } else if (n != sizeof ev) {
-            errno = EIO;
             break;
         }
 
-        if (ev.type == EV_KEY) {
-            send_key_stroke(ev.value, ev.code, fdSer);
+        for (int ix = 0; ix < n; ix++) {
+
+            event_source* src = ready[ix].data.ptr;
+            if (src == NULL) {
+                continue; // quitRequested is set
+            }
+
+            ssize_t len = read(src->fd, ev, sizeof(ev));
+
+            if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+
+            if (len <= 0 || len % sizeof(*ev) != 0) {
+                // e.g. device unplugged; keep going with the others
+                log_warn("stopped reading from %s: %s", src->name,
+                    len < 0 ? strerror(errno) :
+                    len == 0 ? "end of file" : "short read");
+                epoll_ctl(ep, EPOLL_CTL_DEL, src->fd, NULL);
+                close(src->fd);
+                src->fd = -1;
+                active--;
+                continue;
+            }
+
+            handle_events(src, ev, len / sizeof(*ev), d, syncFocus, fdSer);
         }
     }
+
+    close(ep);
+    if (active == 0) {
+        errno = ENODEV;
+    }
 }
 
 
@@ -487,34 +1639,62 @@ void read_kbd_and_send(Display* d, int fdKbd, int fdSer) {
 //
 void usage() {
     printf("\nsynopsis:\n\n  kev \
--p {serial port device} [-i {keyboard image file}] [-k {keyboard device}] [-a] \
-[-v debug|trace]\n\n\
+-p {serial port device} [-i {keyboard image file}] [-k {keyboard device}]... [-a] \
+[-c] [-b {baud rate}] [-H] [-v debug|trace] [--bench] [--sync-focus] \
+[--low-latency] [--ping {count}] [--record {file}] [--replay {file} \
+[--speed {factor}] [--from {s}]]\n\n\
     -i  open new window with given image file and listen for key events there;\n\
         does not require root privileges, and all key event sources of the\n\
         system will be considered, i.e. all attached keyboards, but also game\n\
         controllers creating key events via e.g. QJoyPad\n\n\
-    -k  read key events only from the given keyboard device; implied when not\n\
-        using -i; requires root privileges\n\n\
+    -k  read key events only from the given input device; can be given several\n\
+        times, e.g. for keyboard and game controller; implied when not using\n\
+        -i; requires root privileges\n\n\
     -a  read all key events, regardless of whether console window is in focus;\n\
         implies -k\n\n\
-    -v  log level, 'debug' or 'trace'\n\n");
+    -c  use compact protocol, which sends one byte per key event instead of\n\
+        two; requires adapter support, negotiated on start\n\n\
+    -b  switch to given baud rate after start, 500000 or 1000000; requires\n\
+        adapter support, negotiated on start, implies -c\n\n\
+    -H  print latency statistics of the adapter, from key events entering it\n\
+        to the according switch changes, and exit; statistics are reset on\n\
+        the adapter, so the next run only covers new key events; implies -c\n\n\
+    -v  log level, 'debug' or 'trace'\n\n\
+    --bench       on exit, print latency from key events entering the kernel\n\
+                  to their hand-over to the serial link; requires -k\n\n\
+    --sync-focus  check input focus on every key event, instead of tracking\n\
+                  focus changes in the background; slower, for comparing with\n\
+                  --bench, or for X servers where tracking doesn't work\n\n\
+    --low-latency set serial port and USB serial adapter to low latency where\n\
+                  supported, lock memory, and use real-time scheduling; may\n\
+                  require root privileges\n\n\
+    --ping        ping adapter given number of times, print round trip times,\n\
+                  and exit; implies -c\n\n\
+    --record      write all key events sent to the adapter to given file,\n\
+                  with their time stamps\n\n\
+    --replay      send key events from given recording to the adapter instead\n\
+                  of reading them from keyboard, and exit; implies -c\n\n\
+    --speed       replay speed factor, default 1; 0 sends as fast as the\n\
+                  adapter accepts\n\n\
+    --from        start replay given number of seconds into the recording\n\n");
     exit(EXIT_SUCCESS);
 }
 
 //
 void cleanup() {
-    close_keyboard(fdKeyboard);
-    send_key_stroke('!', 0, fdSerialPort); // reset adapter
+    if (benchmark) {
+        print_samples("forwarding", &forwardLatency);
+    }
+    close_event_sources();
+    if (recording) {
+        recording = 0;
+        rec_close(&recorder);
+    }
+    drain_send_queue(1000);
+    reset_adapter(fdSerialPort);
     close_serial_port(fdSerialPort);
 }
 
-//
-void sigIntHandler() {
-    cleanup();
-    log_info("exiting");
-    exit(0);
-}
-
 //
 int main(int argc, char* argv[]) {
 
@@ -524,21 +1704,49 @@ int main(int argc, char* argv[]) {
         usage();
     }
 
-    char* devKbd = NULL;
+    char* devKbds[MAX_EVENT_SOURCES];
+    int devCount = 0;
     char* imgKbd = NULL;
     char* portName = NULL;
     int useDisplay = 1;
+    int version = 1;
+    int baudCode = 0;
+    int histograms = 0;
+    int syncFocus = 0;
+    int pings = 0;
+    char* recordFile = NULL;
+    char* replayFile = NULL;
+    double speed = 1;
+    double from = 0;
+
+    static struct option longOptions[] = {
+        {"bench", no_argument, NULL, OPT_BENCH},
+        {"sync-focus", no_argument, NULL, OPT_SYNC_FOCUS},
+        {"low-latency", no_argument, NULL, OPT_LOW_LATENCY},
+        {"ping", required_argument, NULL, OPT_PING},
+        {"record", required_argument, NULL, OPT_RECORD},
+        {"replay", required_argument, NULL, OPT_REPLAY},
+        {"speed", required_argument, NULL, OPT_SPEED},
+        {"from", required_argument, NULL, OPT_FROM},
+        {NULL, 0, NULL, 0}
+    };
 
     int opt;
-    while((opt = getopt(argc, argv, ":hk:i:p:lv:")) != -1) {
+    while((opt = getopt_long(
+        argc, argv, ":hk:i:p:lcb:Hv:", longOptions, NULL)) != -1) {
         switch(opt) {
 
             case 'h':
                 usage();
                 break;
 
-            case 'k': // keyboard (optional)
-                devKbd = optarg;
+            case 'k': // keyboard (optional, repeatable)
+                if (devCount == LEN(devKbds)) {
+                    log_fatal("too many input devices, at most %d are supported",
+                        MAX_EVENT_SOURCES);
+                    return EXIT_FAILURE;
+                }
+                devKbds[devCount++] = optarg;
                 break;
 
             case 'i': // keyboard image (optional)
@@ -553,6 +1761,20 @@ int main(int argc, char* argv[]) {
                 useDisplay = 0;
                 break;
 
+            case 'c': // compact protocol (optional)
+                version = PROTOCOL_VERSION;
+                break;
+
+            case 'b': // baud rate (optional)
+                baudCode = get_baud_code_or_die(optarg);
+                version = PROTOCOL_VERSION;
+                break;
+
+            case 'H': // latency statistics (optional)
+                histograms = 1;
+                version = PROTOCOL_VERSION;
+                break;
+
             case 'v': // log level
                 if (strcmp("debug", optarg) == 0) {
                     log_set_level(LOG_DEBUG);
@@ -566,6 +1788,52 @@ int main(int argc, char* argv[]) {
                 }
                 break;
 
+            case OPT_BENCH: // forwarding latency (optional)
+                benchmark = 1;
+                break;
+
+            case OPT_SYNC_FOCUS: // check focus per key event (optional)
+                syncFocus = 1;
+                break;
+
+            case OPT_LOW_LATENCY: // low latency serial link (optional)
+                lowLatency = 1;
+                break;
+
+            case OPT_PING: // round trip times (optional)
+                pings = atoi(optarg);
+                if (pings <= 0) {
+                    log_fatal("invalid ping count: %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                version = PROTOCOL_VERSION;
+                break;
+
+            case OPT_RECORD: // record session (optional)
+                recordFile = optarg;
+                break;
+
+            case OPT_REPLAY: // replay session (optional)
+                replayFile = optarg;
+                version = PROTOCOL_VERSION;
+                break;
+
+            case OPT_SPEED: // replay speed (optional)
+                speed = atof(optarg);
+                if (speed < 0) {
+                    log_fatal("invalid replay speed: %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case OPT_FROM: // replay start (optional)
+                from = atof(optarg);
+                if (from < 0) {
+                    log_fatal("invalid replay start: %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
             case ':':
                 log_fatal("option needs a value");
                 return EXIT_FAILURE;
@@ -576,8 +1844,9 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (imgKbd == NULL && devKbd == NULL) {
-        devKbd = "/dev/input/by-path/platform-i8042-serio-0-event-kbd";
+    if (imgKbd == NULL && devCount == 0) {
+        devKbds[devCount++] =
+            "/dev/input/by-path/platform-i8042-serio-0-event-kbd";
     }
 
     if (imgKbd != NULL && !useDisplay) {
@@ -585,9 +1854,52 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    signal(SIGINT, sigIntHandler);
+    if (benchmark && devCount == 0) {
+        log_fatal("--bench requires -k");
+        return EXIT_FAILURE;
+    }
+
+    setup_signals_or_die();
 
     fdSerialPort = open_serial_port_or_die(portName);
+    if (lowLatency) {
+        set_low_latency(fdSerialPort, portName);
+    }
+    if (version > 1 || baudCode > 0) {
+        negotiate_or_die(fdSerialPort, version, baudCode);
+    }
+
+    if (histograms) {
+        query_histograms_or_die(fdSerialPort);
+        // leave adapter in version 1 at default baud rate, as after start-up
+        reset_adapter(fdSerialPort);
+        close_serial_port(fdSerialPort);
+        return EXIT_SUCCESS;
+    }
+
+    if (pings > 0) {
+        ping_or_die(fdSerialPort, pings);
+        reset_adapter(fdSerialPort);
+        close_serial_port(fdSerialPort);
+        return EXIT_SUCCESS;
+    }
+
+    start_serial_reader_or_die(&fdSerialPort);
+
+    if (replayFile != NULL) {
+        replay_or_die(replayFile, from, speed, fdSerialPort);
+        cleanup();
+        return txq.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (recordFile != NULL) {
+        if (!rec_create(&recorder, recordFile)) {
+            log_fatal("cannot record to %s", recordFile);
+            return EXIT_FAILURE;
+        }
+        recording = 1;
+        log_info("recording to %s", recordFile);
+    }
 
     Display* disp = NULL;
     if (useDisplay) {
@@ -595,7 +1907,7 @@ int main(int argc, char* argv[]) {
     }
 
     if (imgKbd != NULL) {
-        open_keyboard_window_or_die(imgKbd, devKbd == NULL);
+        open_keyboard_window_or_die(imgKbd, devCount == 0);
         strncpy(ownWindowName, IMAGE_WINDOW_NAME, sizeof(ownWindowName)-1);
     } else {
         if (useDisplay) {
@@ -605,20 +1917,34 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (devKbd == NULL) {
+    if (disp != NULL && devCount > 0 && !syncFocus) {
+        start_focus_watcher_or_die(disp);
+    }
+
+    if (devCount == 0) {
         log_info("listening for key events on image window");
-        sigset_t mask;
-        sigemptyset(&mask);
-        sigsuspend(&mask);
-    } else {
-        log_info("reading key events from keyboard %s", devKbd);
-        fdKeyboard = open_keyboard_or_die(devKbd);
-        read_kbd_and_send(disp, fdKeyboard, fdSerialPort);
-        // read_xevents_and_send(disp, fdSerialPort);
     }
 
+    for (int ix = 0; ix < devCount; ix++) {
+        log_info("reading key events from %s", devKbds[ix]);
+        int fd = open_keyboard_or_die(devKbds[ix]);
+        add_event_source_or_die(fd, devKbds[ix], 0);
+        if (benchmark) {
+            set_event_clock(fd);
+        }
+    }
+
+    read_events_and_send(disp, syncFocus, fdSerialPort);
+
+    int err = errno;
     cleanup();
+
+    if (quitRequested && !txq.failed) {
+        log_info("exiting");
+        return EXIT_SUCCESS;
+    }
+
     fflush(stdout);
-    log_fatal("%s", strerror(errno));
+    log_fatal("%s", txq.failed ? "serial link failed" : strerror(err));
     return EXIT_FAILURE;
 }
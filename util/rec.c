@@ -0,0 +1,327 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "rec.h"
+
+/*
+    Recordings of forwarded key events. A recording is only ever appended to,
+    and consists of a 16 byte header, followed by index blocks. All numbers
+    are little endian.
+
+    header:  "KEVR", format version (1 byte), reserved (1 byte), events per
+             block at most (2 bytes), wall clock time of recording start in µs
+             (8 bytes)
+
+    block:   'I', time of first event in block in µs since first event of
+             recording (8 bytes), number of events (2 bytes), length of the
+             events in bytes (4 bytes), events
+
+    event:   varint time in µs since previous event, or for the first event
+             in a block since block time; varint key code << 2 | make << 1 |
+             end of frame
+
+    Varints are LEB128, i.e. 7 bits per byte, lowest first, bit 7 set if
+    more bytes follow. Events are collected in memory until a block is full,
+    or a second has passed, and then written as a whole. Readers can thus
+    hop from block to block for seeking, without decoding any events.
+ */
+
+#define MAGIC "KEVR"
+#define VERSION 1
+#define HEADER_SIZE 16
+#define BLOCK_TAG 'I'
+#define BLOCK_HEADER_SIZE 15
+#define BLOCK_SPAN 1000000 // µs
+
+//
+static void put_le(unsigned char* buf, unsigned long long v, int len) {
+    for (int ix = 0; ix < len; ix++, v >>= 8) {
+        buf[ix] = v & 0xff;
+    }
+}
+
+//
+static unsigned long long get_le(const unsigned char* buf, int len) {
+    unsigned long long v = 0;
+    for (int ix = len - 1; ix >= 0; ix--) {
+        v = v << 8 | buf[ix];
+    }
+    return v;
+}
+
+//
+static int put_varint(unsigned char* buf, unsigned long long v) {
+    int len = 0;
+    do {
+        buf[len] = v & 0x7f;
+        v >>= 7;
+        if (v) {
+            buf[len] |= 0x80;
+        }
+        len++;
+    } while (v);
+    return len;
+}
+
+// returns 0 at end of file, or if varint is too long
+static int get_varint(FILE* f, unsigned long long* v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) {
+            return 0;
+        }
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// --- writing ----------------------------------------------------------------
+
+//
+int rec_create(rec_writer* w, const char* file) {
+
+    memset(w, 0, sizeof(*w));
+
+    w->file = fopen(file, "wb");
+    if (w->file == NULL) {
+        log_error("cannot create recording %s: %s", file, strerror(errno));
+        return 0;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    unsigned char header[HEADER_SIZE] = MAGIC;
+    header[4] = VERSION;
+    put_le(header + 6, REC_BLOCK_EVENTS, 2);
+    put_le(header + 8, now.tv_sec * 1000000ULL + now.tv_usec, 8);
+
+    if (fwrite(header, sizeof(header), 1, w->file) != 1) {
+        log_error("cannot write recording: %s", strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+// write collected events as block
+static int flush_block(rec_writer* w) {
+
+    if (w->blockEvents == 0) {
+        return 1;
+    }
+
+    unsigned char header[BLOCK_HEADER_SIZE];
+    header[0] = BLOCK_TAG;
+    put_le(header + 1, w->blockTime, 8);
+    put_le(header + 9, w->blockEvents, 2);
+    put_le(header + 11, w->blockLen, 4);
+
+    int len = w->blockLen;
+    w->blockEvents = 0;
+    w->blockLen = 0;
+
+    if (fwrite(header, sizeof(header), 1, w->file) != 1
+        || fwrite(w->block, len, 1, w->file) != 1
+        || fflush(w->file) != 0) {
+        log_error("cannot write recording: %s", strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+//
+int rec_add(rec_writer* w, unsigned long long stamp, int code, int make,
+    int frameEnd) {
+
+    if (!w->started) {
+        w->base = stamp;
+        w->started = 1;
+    }
+
+    // events from different devices may be read slightly out of order
+    unsigned long long time = stamp > w->base ? stamp - w->base : 0;
+    if (time < w->last) {
+        time = w->last;
+    }
+
+    if (w->blockEvents == REC_BLOCK_EVENTS
+        || (w->blockEvents > 0 && time - w->blockTime >= BLOCK_SPAN)) {
+        if (!flush_block(w)) {
+            return 0;
+        }
+    }
+
+    if (w->blockEvents == 0) {
+        w->blockTime = time;
+        w->last = time;
+    }
+
+    unsigned char* p = w->block + w->blockLen;
+    p += put_varint(p, time - w->last);
+    p += put_varint(p,
+        (unsigned long long)code << 2 | (make ? 2 : 0) | (frameEnd ? 1 : 0));
+
+    w->blockLen = p - w->block;
+    w->blockEvents++;
+    w->last = time;
+    return 1;
+}
+
+//
+int rec_close(rec_writer* w) {
+
+    if (w->file == NULL) {
+        return 1;
+    }
+
+    int ok = flush_block(w);
+    if (fclose(w->file) != 0) {
+        log_error("cannot close recording: %s", strerror(errno));
+        ok = 0;
+    }
+    w->file = NULL;
+    return ok;
+}
+
+// --- reading ----------------------------------------------------------------
+
+//
+int rec_open(rec_reader* r, const char* file) {
+
+    memset(r, 0, sizeof(*r));
+
+    r->file = fopen(file, "rb");
+    if (r->file == NULL) {
+        log_error("cannot open recording %s: %s", file, strerror(errno));
+        return 0;
+    }
+
+    unsigned char header[HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, r->file) != 1
+        || memcmp(header, MAGIC, 4) != 0) {
+        log_error("%s is not a recording", file);
+        rec_close_reader(r);
+        return 0;
+    }
+
+    if (header[4] != VERSION) {
+        log_error("unsupported recording format version %d", header[4]);
+        rec_close_reader(r);
+        return 0;
+    }
+
+    r->start = get_le(header + 8, 8);
+    return 1;
+}
+
+// read block header; returns 1 if there was one, 0 at end of recording, and
+// -1 on error
+static int read_block_header(rec_reader* r, unsigned long long* time,
+    int* events, long* len) {
+
+    unsigned char header[BLOCK_HEADER_SIZE];
+    size_t n = fread(header, 1, sizeof(header), r->file);
+
+    if (n == 0 && feof(r->file)) {
+        return 0;
+    }
+
+    if (n != sizeof(header) || header[0] != BLOCK_TAG) {
+        log_error("corrupt recording");
+        return -1;
+    }
+
+    *time = get_le(header + 1, 8);
+    *events = get_le(header + 9, 2);
+    *len = get_le(header + 11, 4);
+    return 1;
+}
+
+//
+int rec_seek(rec_reader* r, unsigned long long time) {
+
+    long pos = ftell(r->file);
+    long found = pos;
+    unsigned long long blockTime;
+    int events;
+    long len;
+    int res;
+
+    // a full block may end with events at the time the next one starts, so
+    // stop at the last block starting before, not at, the given time
+    while ((res = read_block_header(r, &blockTime, &events, &len)) > 0
+        && blockTime < time) {
+        found = pos;
+        if (fseek(r->file, len, SEEK_CUR) != 0) {
+            res = -1;
+            break;
+        }
+        pos = ftell(r->file);
+    }
+
+    if (res < 0 || fseek(r->file, found, SEEK_SET) != 0) {
+        return 0;
+    }
+
+    r->remaining = 0;
+    return 1;
+}
+
+//
+int rec_next(rec_reader* r, rec_event* ev) {
+
+    if (r->remaining == 0) {
+        long len;
+        int res = read_block_header(r, &r->time, &r->remaining, &len);
+        if (res <= 0) {
+            return res;
+        }
+    }
+
+    unsigned long long delta, key;
+    if (!get_varint(r->file, &delta) || !get_varint(r->file, &key)) {
+        log_error("corrupt recording");
+        return -1;
+    }
+
+    r->time += delta;
+    r->remaining--;
+
+    ev->time = r->time;
+    ev->code = key >> 2;
+    ev->make = (key & 2) != 0;
+    ev->frameEnd = key & 1;
+    return 1;
+}
+
+//
+void rec_close_reader(rec_reader* r) {
+    if (r->file != NULL) {
+        fclose(r->file);
+        r->file = NULL;
+    }
+}
@@ -0,0 +1,79 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef REC_H
+#define REC_H
+
+#include <stdio.h>
+
+// events per index block at most
+#define REC_BLOCK_EVENTS 256
+// longest encoding of an event, two varints
+#define REC_EVENT_MAX 15
+
+// key event in a recording, time in µs since first event
+typedef struct {
+    unsigned long long time;
+    int code;
+    int make;
+    int frameEnd; // last key of a frame, i.e. up to SYN_REPORT
+} rec_event;
+
+//
+typedef struct {
+    FILE* file;
+    int started;
+    unsigned long long base;      // time stamp of first event
+    unsigned long long last;      // time of previous event, since base
+    unsigned long long blockTime; // time of first event in block
+    int blockEvents;
+    int blockLen;
+    unsigned char block[REC_BLOCK_EVENTS * REC_EVENT_MAX];
+} rec_writer;
+
+//
+typedef struct {
+    FILE* file;
+    unsigned long long start;     // wall clock time of recording, µs
+    unsigned long long time;      // time of last event read
+    int remaining;                // events left in current block
+} rec_reader;
+
+// create recording file; returns 0 on error
+int rec_create(rec_writer* w, const char* file);
+
+// add key event with given time stamp in µs; returns 0 on error
+int rec_add(rec_writer* w, unsigned long long stamp, int code, int make,
+    int frameEnd);
+
+// write pending events and close recording; returns 0 on error
+int rec_close(rec_writer* w);
+
+// open recording for replay; returns 0 on error
+int rec_open(rec_reader* r, const char* file);
+
+// move to the block containing given time in µs since first event, so that
+// no events at or after that time are skipped; returns 0 on error
+int rec_seek(rec_reader* r, unsigned long long time);
+
+// read next event; returns 1 if there was one, 0 at end of recording, and -1
+// on error
+int rec_next(rec_reader* r, rec_event* ev);
+
+//
+void rec_close_reader(rec_reader* r);
+
+#endif
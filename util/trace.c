@@ -0,0 +1,82 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+
+#include "../src/trace_events.h"
+#include "log.h"
+#include "trace.h"
+
+/*
+    Decoder for the trace records the adapter sends in debug mode. Each record
+    is 9 bytes: event id, time stamp, and three arguments, all 16 bit values
+    little endian. The time stamp is Timer1 of the adapter, which counts in
+    4µs steps and wraps around after about 262ms. We keep our own clock by
+    adding up the differences between consecutive records, so the times shown
+    are only right as long as records are no more than 262ms apart.
+ */
+
+#define RECORD_SIZE 9
+#define TICK_US 4
+
+#define TRACE_EVENT_FORMAT(name, format) format,
+
+static const char *const formats[] = {
+    TRACE_EVENTS(TRACE_EVENT_FORMAT)
+};
+
+static int started = 0;
+static unsigned short lastStamp = 0;
+static unsigned long long elapsed = 0; // in timer counts
+
+//
+unsigned long long trace_render(const unsigned char* rec, char* buf, int size) {
+
+    unsigned short stamp = rec[1] | rec[2] << 8;
+    unsigned int a = rec[3] | rec[4] << 8;
+    unsigned int b = rec[5] | rec[6] << 8;
+    unsigned int c = rec[7] | rec[8] << 8;
+
+    if (started) {
+        elapsed += (unsigned short)(stamp - lastStamp);
+    }
+    started = 1;
+    lastStamp = stamp;
+
+    if (rec[0] < TRACE_EVENT_COUNT) {
+        snprintf(buf, size, formats[rec[0]], a, b, c);
+    } else {
+        snprintf(buf, size, "[TRCE] unknown event %u: %u, %u, %u",
+            rec[0], a, b, c);
+    }
+
+    return elapsed * TICK_US;
+}
+
+//
+void trace_print(const unsigned char* payload, int len) {
+
+    char text[128];
+
+    if (len % RECORD_SIZE != 0) {
+        log_warn("trace frame of invalid length %d", len);
+    }
+
+    for (; len >= RECORD_SIZE; len -= RECORD_SIZE, payload += RECORD_SIZE) {
+        unsigned long long us = trace_render(payload, text, sizeof(text));
+        log_debug("adapter: %8llu.%03llu %s", us / 1000, us % 1000, text);
+    }
+}
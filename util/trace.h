@@ -0,0 +1,27 @@
+/*
+    Copyright 2022 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// render trace records received from adapter in debug mode, and log them
+void trace_print(const unsigned char* payload, int len);
+
+// render a single trace record into buf; returns time stamp of record in µs
+// since the first record seen
+unsigned long long trace_render(const unsigned char* rec, char* buf, int size);
+
+#endif